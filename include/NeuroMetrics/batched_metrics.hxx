@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include <andres/marray.hxx>
+
+#include "NeuroMetrics/metrics.hxx"
+#include "NeuroMetrics/contingency_table.hxx"
+#include "NeuroMetrics/tools/threadpool.hxx"
+
+namespace neurometrics {
+
+// columns of the batched results, one row per candidate segmentation
+enum BatchedMetric {
+    BatchedRandIndex = 0,
+    BatchedRandPrecision,
+    BatchedRandRecall,
+    BatchedRandScore,
+    BatchedVariationOfInformation,
+    BatchedViPrecision,
+    BatchedViRecall,
+    BatchedViScore,
+    NumberOfBatchedMetrics
+};
+
+
+// compute the contingency tables of one ground truth against many candidate segmentations,
+// metrics[i] holds the table of candidates[i] afterwards.
+// the ground truth is traversed once: each of its blocks is counted against all candidates
+// while it is still in cache, so the ground truth reads do not grow with the number of candidates
+template<unsigned DIM, class T>
+void computeContingencyTables(
+        const andres::View<T> & gt,
+        const std::vector<andres::View<T> > & candidates,
+        std::vector<NeuroMetrics<DIM,T> > & metrics,
+        const int numberOfThreads = -1
+        )
+{
+
+    typedef std::array<int64_t,DIM> Coord;
+    typedef SparseContingencyTable<T> ContingencyTable;
+
+    const size_t nCandidates = candidates.size();
+
+    size_t size = 1;
+    Coord shape;
+    for(size_t d = 0; d < DIM; ++d) {
+        shape[d] = gt.shape(d);
+        size *= shape[d];
+    }
+    for(const auto & candidate : candidates) {
+        for(size_t d = 0; d < DIM; ++d) {
+            if(candidate.shape(d) != gt.shape(d))
+                throw std::runtime_error("Segmentations must have the same shape");
+        }
+    }
+
+    tools::ThreadPool threadpool(numberOfThreads);
+    const size_t actualNumThreads = std::max<size_t>(threadpool.nThreads(), 1);
+
+    // smaller blocks than for a single segmentation,
+    // the ground truth block has to stay in cache while all candidates are counted
+    const int64_t blockSize = 1 << 16;
+
+    // one private table per candidate and thread
+    std::vector<std::vector<ContingencyTable> > cTableThreadVec(
+        nCandidates, std::vector<ContingencyTable>(actualNumThreads));
+
+    bool contiguous = size > 0;
+    for(const auto & candidate : candidates)
+        contiguous = contiguous && haveContiguousLayout(gt, candidate);
+    const T * labelsGt = contiguous ? dataPointer<DIM>(gt) : nullptr;
+    std::vector<const T *> labelsCandidates;
+    if(contiguous) {
+        for(const auto & candidate : candidates)
+            labelsCandidates.push_back(dataPointer<DIM>(candidate));
+    }
+
+    parallelForEachRange<DIM>(threadpool, shape, contiguous, blockSize,
+    [&](const int tid, const size_t offset, const size_t rangeSize){
+        for(size_t i = 0; i < nCandidates; ++i)
+            countOverlaps(labelsGt + offset, labelsCandidates[i] + offset, rangeSize, cTableThreadVec[i][tid]);
+    },
+    [&](const int tid, const Coord & blockBegin, const Coord & blockShape){
+        const andres::View<T> gtBlock = gt.view(blockBegin.begin(), blockShape.begin());
+        for(size_t i = 0; i < nCandidates; ++i)
+            countOverlaps<DIM>(gtBlock,
+                candidates[i].view(blockBegin.begin(), blockShape.begin()),
+                cTableThreadVec[i][tid]);
+    });
+
+    // merge the thread tables of all candidates in one parallel reduction,
+    // then relabel them, the candidates are processed in parallel
+    parallelMerge(threadpool, cTableThreadVec);
+    metrics.resize(nCandidates);
+    tools::parallel_foreach(threadpool, nCandidates, [&](const int tid, const int64_t candidateId){
+        metrics[candidateId].assignContingencyTable(cTableThreadVec[candidateId][0], size);
+    });
+}
+
+
+// evaluate many candidate segmentations against one ground truth,
+// results needs the shape (candidates.size(), NumberOfBatchedMetrics),
+// row i holds the metrics of candidates[i] in the order of BatchedMetric
+template<unsigned DIM, class T>
+void batchedMetrics(
+        const andres::View<T> & gt,
+        const std::vector<andres::View<T> > & candidates,
+        andres::View<double> & results,
+        const int numberOfThreads = -1
+        )
+{
+    if(results.dimension() != 2 || results.shape(0) != candidates.size()
+            || results.shape(1) != NumberOfBatchedMetrics)
+        throw std::runtime_error("Results must have the shape (number of candidates, number of metrics)");
+
+    std::vector<NeuroMetrics<DIM,T> > metrics;
+    computeContingencyTables<DIM>(gt, candidates, metrics, numberOfThreads);
+
+    for(size_t i = 0; i < metrics.size(); ++i) {
+        auto & m = metrics[i];
+        results(i, size_t(BatchedRandIndex)) = m.randIndex();
+        results(i, size_t(BatchedRandPrecision)) = m.randPrecision();
+        results(i, size_t(BatchedRandRecall)) = m.randRecall();
+        results(i, size_t(BatchedRandScore)) = m.randScore();
+        results(i, size_t(BatchedVariationOfInformation)) = m.variationOfInformation();
+        results(i, size_t(BatchedViPrecision)) = m.viPrecision();
+        results(i, size_t(BatchedViRecall)) = m.viRecall();
+        results(i, size_t(BatchedViScore)) = m.viScore();
+    }
+}
+
+} // namespace neurometrics
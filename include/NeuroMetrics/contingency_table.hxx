@@ -0,0 +1,491 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include <andres/marray.hxx>
+
+#include "NeuroMetrics/tools/counting_hash_map.hxx"
+#include "NeuroMetrics/tools/for_each_coordinate.hxx"
+#include "NeuroMetrics/tools/threadpool.hxx"
+#include "NeuroMetrics/tools/for_each_block.hxx"
+
+namespace neurometrics {
+
+// sparse contingency table, stores only the (labelA, labelB) pairs that overlap
+// -> memory scales with the number of distinct overlaps, not with maxA * maxB
+template<class T>
+class SparseContingencyTable {
+
+public:
+    typedef std::pair<T,T> LabelPair;
+    typedef tools::CountingHashMap<LabelPair> OverlapMap;
+
+    SparseContingencyTable(const size_t expectedNumberOfOverlaps = 0)
+        : overlaps_(expectedNumberOfOverlaps)
+    {}
+
+    inline void add(const T labelA, const T labelB, const double count = 1.) {
+        overlaps_.add(LabelPair(labelA, labelB), count);
+    }
+
+    inline double get(const T labelA, const T labelB) const {
+        return overlaps_.get(LabelPair(labelA, labelB));
+    }
+
+    void merge(const SparseContingencyTable & other) {
+        overlaps_.merge(other.overlaps_);
+    }
+
+    // call f(labelA, labelB, count) for every non-zero entry
+    template<class F>
+    void forEachEntry(F && f) const {
+        overlaps_.forEach([&](const LabelPair & labels, const double count){
+            f(labels.first, labels.second, count);
+        });
+    }
+
+    size_t numberOfEntries() const {
+        return overlaps_.size();
+    }
+
+    void clear() {
+        overlaps_.clear();
+    }
+
+    void swap(SparseContingencyTable & other) {
+        std::swap(overlaps_, other.overlaps_);
+    }
+
+private:
+    OverlapMap overlaps_;
+};
+
+
+// contingency table relabeled to consecutive ids, built from the sparse table once counting is done.
+// rows are the sorted non-zero labels of A, cols the sorted non-zero labels of B,
+// so all per-label arrays are sized by the number of segments, not by the max label.
+// rowLabels / colLabels map the ids back to the original labels.
+// label 0 of A is ignored, the overlap of A with label 0 of B is only kept as a total.
+// segments of B that only overlap label 0 of A have a col with sum 0, so they are known to the edits
+template<class T>
+class CompactContingencyTable {
+
+public:
+    typedef std::vector<std::pair<size_t,double> > Column; // (row, count), sorted by row
+
+    CompactContingencyTable()
+        : rowLabels_(), colLabels_(), rowSums_(), colSums_(), colBackgroundSums_(), columns_(), unlabeledCount_(0.)
+    {}
+
+    void assign(const SparseContingencyTable<T> & table);
+
+    void clear() {
+        rowLabels_.clear(); colLabels_.clear();
+        rowSums_.clear(); colSums_.clear(); colBackgroundSums_.clear();
+        columns_.clear();
+        unlabeledCount_ = 0.;
+    }
+
+    // call f(row, col, count) for every non-zero entry with labels != 0
+    template<class F>
+    void forEachEntry(F && f) const {
+        for(size_t col = 0; col < columns_.size(); ++col) {
+            for(const auto & entry : columns_[col])
+                f(entry.first, col, entry.second);
+        }
+    }
+
+    size_t numberOfRows() const { return rowLabels_.size(); }
+    size_t numberOfCols() const { return colLabels_.size(); }
+
+    // id of a label, numberOfRows() / numberOfCols() if the label is not in the table
+    size_t rowId(const T label) const { return labelId(rowLabels_, label); }
+    size_t colId(const T label) const { return labelId(colLabels_, label); }
+
+    // editing of the cols, used for incremental updates after merges and splits of segments in B.
+    // the callbacks f(oldCount, newCount) are called for every entry that changes its count,
+    // so that quantities derived from the entries can be updated without a full recount
+
+    // add an empty col for a label that is not in the table yet and return its id,
+    // the ids of the cols behind it are shifted by one
+    size_t insertCol(const T label);
+
+    // move all entries of col other into col, other is left empty but keeps its id
+    template<class F>
+    void mergeCols(const size_t col, const size_t other, F && f);
+
+    // move the (row, count) pairs in overlap, sorted by row, and backgroundCount elements
+    // with label 0 of A from col to col other. throws before any change if col holds less
+    template<class F>
+    void moveEntries(const size_t col, const size_t other, const Column & overlap,
+        const double backgroundCount, F && f);
+
+    const std::vector<T> & rowLabels() const { return rowLabels_; }
+    const std::vector<T> & colLabels() const { return colLabels_; }
+    // the row sums include the overlap with label 0 of B, the col sums exclude label 0 of A
+    const std::vector<double> & rowSums() const { return rowSums_; }
+    const std::vector<double> & colSums() const { return colSums_; }
+    // number of elements per col that have label 0 in A
+    const std::vector<double> & colBackgroundSums() const { return colBackgroundSums_; }
+    const Column & column(const size_t col) const { return columns_[col]; }
+    // number of elements with a label in A that have label 0 in B
+    double unlabeledCount() const { return unlabeledCount_; }
+
+private:
+    static size_t labelId(const std::vector<T> & labels, const T label) {
+        auto it = std::lower_bound(labels.begin(), labels.end(), label);
+        return (it != labels.end() && *it == label) ? size_t(it - labels.begin()) : labels.size();
+    }
+
+    std::vector<T> rowLabels_;
+    std::vector<T> colLabels_;
+    std::vector<double> rowSums_;
+    std::vector<double> colSums_;
+    std::vector<double> colBackgroundSums_;
+    std::vector<Column> columns_;
+    double unlabeledCount_;
+};
+
+
+template<class T>
+void CompactContingencyTable<T>::assign(const SparseContingencyTable<T> & table)
+{
+    clear();
+
+    // sort-unique pass over the labels of the table
+    table.forEachEntry([&](const T labelA, const T labelB, const double count){
+        if(labelA != 0)
+            rowLabels_.push_back(labelA);
+        if(labelB != 0)
+            colLabels_.push_back(labelB);
+    });
+    std::sort(rowLabels_.begin(), rowLabels_.end());
+    rowLabels_.erase(std::unique(rowLabels_.begin(), rowLabels_.end()), rowLabels_.end());
+    std::sort(colLabels_.begin(), colLabels_.end());
+    colLabels_.erase(std::unique(colLabels_.begin(), colLabels_.end()), colLabels_.end());
+
+    auto rowId = [&](const T label) {
+        return size_t(std::lower_bound(rowLabels_.begin(), rowLabels_.end(), label) - rowLabels_.begin());
+    };
+    auto colId = [&](const T label) {
+        return size_t(std::lower_bound(colLabels_.begin(), colLabels_.end(), label) - colLabels_.begin());
+    };
+
+    // relabel the entries, sorting them by row keeps the columns sorted as well
+    struct Entry { size_t row; size_t col; double count; };
+    std::vector<Entry> entries;
+    entries.reserve(table.numberOfEntries());
+    rowSums_.assign(rowLabels_.size(), 0.);
+    colSums_.assign(colLabels_.size(), 0.);
+    colBackgroundSums_.assign(colLabels_.size(), 0.);
+    table.forEachEntry([&](const T labelA, const T labelB, const double count){
+        if(labelA == 0) {
+            if(labelB != 0)
+                colBackgroundSums_[colId(labelB)] += count;
+            return;
+        }
+        const size_t row = rowId(labelA);
+        rowSums_[row] += count;
+        if(labelB == 0) {
+            unlabeledCount_ += count;
+            return;
+        }
+        const size_t col = colId(labelB);
+        colSums_[col] += count;
+        entries.push_back(Entry{row, col, count});
+    });
+    std::sort(entries.begin(), entries.end(), [](const Entry & a, const Entry & b){
+        return a.row < b.row;
+    });
+
+    columns_.assign(colLabels_.size(), Column());
+    for(const auto & entry : entries)
+        columns_[entry.col].emplace_back(entry.row, entry.count);
+}
+
+
+template<class T>
+size_t CompactContingencyTable<T>::insertCol(const T label)
+{
+    const size_t col = std::lower_bound(colLabels_.begin(), colLabels_.end(), label) - colLabels_.begin();
+    colLabels_.insert(colLabels_.begin() + col, label);
+    colSums_.insert(colSums_.begin() + col, 0.);
+    colBackgroundSums_.insert(colBackgroundSums_.begin() + col, 0.);
+    columns_.insert(columns_.begin() + col, Column());
+    return col;
+}
+
+
+template<class T>
+template<class F>
+void CompactContingencyTable<T>::mergeCols(const size_t col, const size_t other, F && f)
+{
+    const Column & a = columns_[col];
+    const Column & b = columns_[other];
+    Column merged;
+    merged.reserve(a.size() + b.size());
+    auto itA = a.begin();
+    auto itB = b.begin();
+    while(itA != a.end() || itB != b.end()) {
+        if(itB == b.end() || (itA != a.end() && itA->first < itB->first))
+            merged.push_back(*itA++);
+        else if(itA == a.end() || itB->first < itA->first)
+            merged.push_back(*itB++);
+        else {
+            // the row overlaps with both cols, the two entries become one
+            const double count = itA->second + itB->second;
+            f(itA->second, count);
+            f(itB->second, 0.);
+            merged.emplace_back(itA->first, count);
+            ++itA; ++itB;
+        }
+    }
+    columns_[col].swap(merged);
+    columns_[other].clear();
+    colSums_[col] += colSums_[other];
+    colSums_[other] = 0.;
+    colBackgroundSums_[col] += colBackgroundSums_[other];
+    colBackgroundSums_[other] = 0.;
+}
+
+
+template<class T>
+template<class F>
+void CompactContingencyTable<T>::moveEntries(
+        const size_t col,
+        const size_t other,
+        const Column & overlap,
+        const double backgroundCount,
+        F && f)
+{
+    Column & source = columns_[col];
+    Column & target = columns_[other];
+
+    // check the overlap before changing anything, so the table stays valid if it throws
+    if(!(backgroundCount >= 0.) || colBackgroundSums_[col] < backgroundCount)
+        throw std::runtime_error("Overlap exceeds the entries of the segment");
+    auto itSource = source.begin();
+    for(const auto & entry : overlap) {
+        while(itSource != source.end() && itSource->first < entry.first)
+            ++itSource;
+        if(itSource == source.end() || itSource->first != entry.first
+                || !(entry.second >= 0.) || itSource->second < entry.second)
+            throw std::runtime_error("Overlap exceeds the entries of the segment");
+        ++itSource;
+    }
+
+    Column remaining;
+    remaining.reserve(source.size());
+    itSource = source.begin();
+    for(const auto & entry : overlap) {
+        while(itSource->first < entry.first)
+            remaining.push_back(*itSource++);
+        const double count = itSource->second - entry.second;
+        f(itSource->second, count);
+        if(count > 0.)
+            remaining.emplace_back(itSource->first, count);
+        ++itSource;
+        colSums_[col] -= entry.second;
+    }
+    remaining.insert(remaining.end(), itSource, source.end());
+    source.swap(remaining);
+
+    Column merged;
+    merged.reserve(target.size() + overlap.size());
+    auto itTarget = target.begin();
+    for(const auto & entry : overlap) {
+        while(itTarget != target.end() && itTarget->first < entry.first)
+            merged.push_back(*itTarget++);
+        double count = entry.second;
+        if(itTarget != target.end() && itTarget->first == entry.first)
+            count += (itTarget++)->second;
+        f(count - entry.second, count);
+        merged.emplace_back(entry.first, count);
+        colSums_[other] += entry.second;
+    }
+    merged.insert(merged.end(), itTarget, target.end());
+    target.swap(merged);
+
+    colBackgroundSums_[col] -= backgroundCount;
+    colBackgroundSums_[other] += backgroundCount;
+}
+
+
+// count the overlaps of two views with the same shape into table,
+// generic path: strided access via the coordinates of each voxel
+template<unsigned DIM, class T>
+void countOverlapsStrided(
+        const andres::View<T> & segA,
+        const andres::View<T> & segB,
+        SparseContingencyTable<T> & table)
+{
+    typedef std::array<int64_t,DIM> Coord;
+
+    Coord shape;
+    for(size_t d = 0; d < DIM; ++d)
+        shape[d] = segA.shape(d);
+
+    tools::forEachCoordinate(shape, [&](const Coord & coord){
+        table.add(segA(coord.begin()), segB(coord.begin()));
+    });
+}
+
+
+// count the overlaps of two label arrays in contiguous memory into table,
+// single linear pass over the raw pointers.
+// neighbouring voxels mostly belong to the same pair of segments,
+// so a run of identical pairs is counted with a single table update
+template<class T>
+void countOverlaps(
+        const T * labelsA,
+        const T * labelsB,
+        const size_t size,
+        SparseContingencyTable<T> & table)
+{
+    if(size == 0)
+        return;
+    T runA = labelsA[0];
+    T runB = labelsB[0];
+    size_t runLength = 0;
+    for(size_t i = 0; i < size; ++i) {
+        if(labelsA[i] != runA || labelsB[i] != runB) {
+            table.add(runA, runB, runLength);
+            runA = labelsA[i];
+            runB = labelsB[i];
+            runLength = 0;
+        }
+        ++runLength;
+    }
+    table.add(runA, runB, runLength);
+}
+
+
+// true if both views are unstrided with the same memory order,
+// then the labels can be paired by their position in memory
+template<class T>
+inline bool haveContiguousLayout(const andres::View<T> & segA, const andres::View<T> & segB) {
+    return segA.isSimple() && segB.isSimple() && segA.coordinateOrder() == segB.coordinateOrder();
+}
+
+
+// pointer to the first element of a view
+template<unsigned DIM, class T>
+inline const T * dataPointer(const andres::View<T> & view) {
+    std::array<int64_t,DIM> zeroCoord;
+    zeroCoord.fill(0);
+    return &view(zeroCoord.begin());
+}
+
+
+// count the overlaps of two views with the same shape into table,
+// takes the fast linear path for contiguous inputs (e.g. c-order numpy arrays)
+template<unsigned DIM, class T>
+void countOverlaps(
+        const andres::View<T> & segA,
+        const andres::View<T> & segB,
+        SparseContingencyTable<T> & table)
+{
+    if(segA.size() == 0)
+        return;
+    if(haveContiguousLayout(segA, segB))
+        countOverlaps(dataPointer<DIM>(segA), dataPointer<DIM>(segB), segA.size(), table);
+    else
+        countOverlapsStrided<DIM>(segA, segB, table);
+}
+
+
+// split a volume of the given shape into ranges of about blockSize elements (a power of 2)
+// and distribute them over the threads of threadpool, as done by all counting engines:
+// contiguous inputs are split into linear ranges of memory, fContiguous(tid, offset, size),
+// strided inputs into cubic blocks of coordinates, fStrided(tid, blockBegin, blockShape).
+// the callers count each range into a private table per thread and merge the tables afterwards
+template<unsigned DIM, class F_CONTIGUOUS, class F_STRIDED>
+void parallelForEachRange(
+        tools::ThreadPool & threadpool,
+        const std::array<int64_t,DIM> & shape,
+        const bool contiguous,
+        const int64_t blockSize,
+        F_CONTIGUOUS && fContiguous,
+        F_STRIDED && fStrided)
+{
+    typedef std::array<int64_t,DIM> Coord;
+
+    size_t size = 1;
+    for(size_t d = 0; d < DIM; ++d)
+        size *= shape[d];
+    if(size == 0)
+        return;
+
+    if(contiguous) {
+        const int64_t numberOfBlocks = (size + blockSize - 1) / blockSize;
+        tools::parallel_foreach(threadpool, numberOfBlocks, [&](const int tid, const int64_t blockId){
+            const size_t blockBegin = blockId * blockSize;
+            fContiguous(tid, blockBegin, std::min<size_t>(blockSize, size - blockBegin));
+        });
+        return;
+    }
+
+    // largest cubic block with at most blockSize elements
+    int64_t blockLength = 1;
+    for(int64_t blockElements = 1 << DIM; blockElements <= blockSize; blockElements <<= DIM)
+        blockLength *= 2;
+    Coord blockShape;
+    blockShape.fill(blockLength);
+    tools::parallelForEachBlock(threadpool, shape, blockShape,
+    [&](const int tid, const Coord & blockBegin, const Coord & blockEnd){
+        Coord currentShape;
+        for(size_t d = 0; d < DIM; ++d)
+            currentShape[d] = blockEnd[d] - blockBegin[d];
+        fStrided(tid, blockBegin, currentShape);
+    });
+}
+
+
+// merge the tables of every group into group[0] by pairwise tree reductions,
+// the merges of all groups within one level of the trees run in parallel,
+// so the pool stays busy even if there are fewer groups than threads
+template<class T>
+void parallelMerge(
+        tools::ThreadPool & threadpool,
+        std::vector<std::vector<SparseContingencyTable<T> > > & groups)
+{
+    size_t maxTables = 0;
+    for(const auto & tables : groups)
+        maxTables = std::max(maxTables, tables.size());
+    for(size_t stride = 1; stride < maxTables; stride *= 2) {
+        const int64_t nMergesPerGroup = (maxTables + 2 * stride - 1) / (2 * stride);
+        tools::parallel_foreach(threadpool, groups.size() * nMergesPerGroup,
+        [&](const int tid, const int64_t mergeId){
+            std::vector<SparseContingencyTable<T> > & tables = groups[mergeId / nMergesPerGroup];
+            const size_t i = 2 * stride * (mergeId % nMergesPerGroup);
+            const size_t j = i + stride;
+            if(j >= tables.size())
+                return;
+            // merge the smaller table into the larger one
+            if(tables[i].numberOfEntries() < tables[j].numberOfEntries())
+                tables[i].swap(tables[j]);
+            tables[i].merge(tables[j]);
+            tables[j].clear();
+        });
+    }
+}
+
+
+// merge all tables into tables[0] by a pairwise tree reduction,
+// the merges within one level of the tree run in parallel
+template<class T>
+void parallelMerge(
+        tools::ThreadPool & threadpool,
+        std::vector<SparseContingencyTable<T> > & tables)
+{
+    std::vector<std::vector<SparseContingencyTable<T> > > groups(1);
+    groups[0].swap(tables);
+    parallelMerge(threadpool, groups);
+    tables.swap(groups[0]);
+}
+
+} // namespace neurometrics
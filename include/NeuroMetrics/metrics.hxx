@@ -1,14 +1,17 @@
 #pragma once
 
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <iterator>
+#include <utility>
 #include <cmath>
 #include <stdexcept>
 
 #include <andres/marray.hxx>
 
-#include "NeuroMetrics/tools/for_each_coordinate.hxx"
-#include "NeuroMetrics/tools/parallel_max_element.hxx"
+#include "NeuroMetrics/contingency_table.hxx"
+#include "NeuroMetrics/tools/threadpool.hxx"
 
 namespace neurometrics {
 
@@ -20,7 +23,8 @@ class NeuroMetrics {
 
 public:
     
-    typedef andres::Marray<double> ContingencyTable;
+    typedef SparseContingencyTable<T> ContingencyTable;
+    typedef CompactContingencyTable<T> CompactTable;
     
     // constructor
     NeuroMetrics();
@@ -29,9 +33,49 @@ public:
     
     // compute contingency table
     void computeContingecyTable(const andres::View<T> &, const andres::View<T> &);
-    // parallel version, not debugged yet! hence not exposed to python
+    // parallel version, every thread counts its blocks into a private table,
+    // the thread tables are merged by a parallel tree reduction
     void computeContingecyTable(const andres::View<T> &, const andres::View<T> &, const int);
 
+    // streaming interface for volumes that do not fit into memory:
+    // fold aligned chunks of the two segmentations into a running contingency table,
+    // the metrics are available after calling finalizeContingencyTable.
+    // finalizing releases the running table, a new stream starts with resetContingencyTable
+    void resetContingencyTable();
+    void accumulateContingencyTable(const andres::View<T> &, const andres::View<T> &, const int = -1);
+    void finalizeContingencyTable();
+
+    // stream all chunks from chunkSource, which is called as
+    // chunkSource(andres::Marray<T> & chunkA, andres::Marray<T> & chunkB) and
+    // returns false once the stream is exhausted.
+    // reading the next chunk overlaps with counting the current one,
+    // so the stream holds two chunk buffers, plus whatever chunkSource keeps while reading
+    template<class CHUNK_SOURCE>
+    void computeContingencyTableFromChunks(CHUNK_SOURCE &&, const int = -1);
+
+    // take over a contingency table that was counted elsewhere (e.g. by the batched or the weighted evaluation)
+    // for segmentations with the given number of elements (or total weight), the passed table is left empty
+    void assignContingencyTable(ContingencyTable &, const double);
+
+    // the contingency table relabeled to consecutive row / col ids,
+    // holds the mapping back to the original labels and the row / col sums
+    const CompactTable & compactContingencyTable() const;
+
+    // incremental updates after edits of segmentation B (e.g. during agglomeration or proofreading),
+    // the table and the metric primitives are updated in O(entries of the affected cols + #cols)
+    // instead of recounting the volume. the edits are lost when the table is recomputed
+
+    // merge segment labelB2 into segment labelB1, merging a label without elements does nothing
+    void merge(const T, const T);
+    // move elements of segment labelB to the new segment newLabelB,
+    // overlap holds (labelA, count) pairs: the number of moved elements per label of A.
+    // throws without changing anything if the overlap exceeds the elements of labelB
+    // or if newLabelB already has elements
+    void split(const T, const T, const std::vector<std::pair<T,double> > &);
+    // same, given the labels of A of all moved elements (e.g. the ground truth at the moved voxels)
+    template<class ITER>
+    void split(const T, const T, ITER, ITER);
+
     // rand measures
     // implementations adapted from
     // https://github.com/fiji/Trainable_Segmentation/blob/master/src/main/java/trainableSegmentation/metrics/RandError.java
@@ -50,24 +94,65 @@ public:
     double viRecall();
     double viScore();
 
+    // per segment error attribution from the relabeled table, computed in O(#overlaps):
+    // split errors of the segments of A (per row) and merge errors of the segments of B (per col).
+    // the vi errors are the per row / col terms of the conditional entropies H(B|A) and H(A|B),
+    // the rand errors the fractions of element pairs that are split / merged by the segment.
+    // summed over all segments they give variationOfInformation and 1 - randIndex,
+    // up to the terms of the elements with label 0 in B, which are only kept as a total
+    const std::vector<double> & viSplitErrors();
+    const std::vector<double> & viMergeErrors();
+    const std::vector<double> & randSplitErrors();
+    const std::vector<double> & randMergeErrors();
+    // the same errors as shared snapshots: recomputing the errors replaces the vectors instead of
+    // overwriting them, so a snapshot stays valid and unchanged (e.g. as the buffer of a numpy array)
+    std::shared_ptr<const std::vector<double> > viSplitErrorsSnapshot();
+    std::shared_ptr<const std::vector<double> > viMergeErrorsSnapshot();
+    std::shared_ptr<const std::vector<double> > randSplitErrorsSnapshot();
+    std::shared_ptr<const std::vector<double> > randMergeErrorsSnapshot();
+
 private:
+
+    // count the two views blockwise into per thread tables and fold them into the contingency table
+    void accumulateContingencyTable(tools::ThreadPool &, const andres::View<T> &, const andres::View<T> &);
+
+    // relabel the contingency table to consecutive ids, compute the row and col sums
+    // and invalidate previously computed primitives
+    void relabelContingencyTable();
     
     // compute rand primitives
     void computeRandPrimitives();
 
     // compute vi primitives
     void computeViPrimitives();
+
+    // p * log(p) for p = count / n, 0 for empty entries
+    double viTerm(const double) const;
+
+    // update the primitives for an entry that changed its count from old to new
+    void updateEntryPrimitives(const double, const double);
+
+    // the col sum terms randB / viB, including the elements with label 0 in B.
+    // they are recomputed after edits instead of updated, so that they agree exactly with a recount:
+    // the vi measures branch on viB == 0, e.g. once all segments are merged into one
+    double randBPrimitive() const;
+    double viBPrimitive() const;
+
+    // compute the per segment errors
+    void computeSegmentErrors();
     
     // flags to keep track of things that were already computed
     bool hasContingencyTable;
     bool hasRandPrimitives;
     bool hasViPrimitives;
+    bool hasSegmentErrors;
     
     // contigency table and stuff
-    size_t n;
+    // the sparse table is used for counting and released once it is compacted, the compact one for the metrics
+    // n is the number of elements, or their total weight for weighted tables
+    double n;
     ContingencyTable contingencyTable;
-    std::vector<double> rowSum;
-    std::vector<double> colSum;
+    CompactTable compactTable;
 
     // rand primitives
     double randA; // quadratic sum of row sums
@@ -78,18 +163,38 @@ private:
     double viA; 
     double viB; 
     double viAB;
+
+    // per segment errors, replaced as a whole when they are recomputed
+    std::shared_ptr<const std::vector<double> > viSplit;  // per row
+    std::shared_ptr<const std::vector<double> > viMerge;  // per col
+    std::shared_ptr<const std::vector<double> > randSplit;// per row
+    std::shared_ptr<const std::vector<double> > randMerge;// per col
 };
 
 
+// ids of the k largest errors, sorted by decreasing error
+inline std::vector<size_t> largestErrors(const std::vector<double> & errors, const size_t k) {
+    std::vector<size_t> ids(errors.size());
+    for(size_t i = 0; i < ids.size(); ++i)
+        ids[i] = i;
+    const size_t actualK = std::min(k, ids.size());
+    std::partial_sort(ids.begin(), ids.begin() + actualK, ids.end(), [&](const size_t a, const size_t b){
+        return errors[a] > errors[b];
+    });
+    ids.resize(actualK);
+    return ids;
+}
+
+
 // implementation
 
 template<unsigned DIM, class T>
 NeuroMetrics<DIM,T>::NeuroMetrics()
-    : hasContingencyTable(false), hasRandPrimitives(false), hasViPrimitives(false),
-    n(0), contingencyTable(),
-    rowSum(), colSum(),
+    : hasContingencyTable(false), hasRandPrimitives(false), hasViPrimitives(false), hasSegmentErrors(false),
+    n(0), contingencyTable(), compactTable(),
     randA(0), randB(0), randAB(0),
-    viA(0), viB(0), viAB(0)
+    viA(0), viB(0), viAB(0),
+    viSplit(), viMerge(), randSplit(), randMerge()
 {}
 
 template<unsigned DIM, class T>
@@ -101,6 +206,11 @@ void NeuroMetrics<DIM,T>::computeContingecyTable(
 
     typedef std::array<int64_t,DIM> Coord;
     
+    for(size_t d = 0; d < DIM; ++d) {
+        if(segA.shape(d) != segB.shape(d))
+            throw std::runtime_error("Segmentations must have the same shape");
+    }
+
     n = 1;
     Coord shape;
     for(size_t d = 0; d < DIM; ++d) {
@@ -108,157 +218,358 @@ void NeuroMetrics<DIM,T>::computeContingecyTable(
         n *= shape[d];
     }
 
-    size_t nLabelsA = *( std::max_element( segA.begin(), segA.end() ) ) + 1;
-    size_t nLabelsB = *( std::max_element( segB.begin(), segB.end() ) ) + 1;
+    // compute the contingency matrix
+    contingencyTable.clear();
+    countOverlaps<DIM>(segA, segB, contingencyTable);
+
+    relabelContingencyTable();
+}
 
-    // init the contingency matrix 
-    size_t contingencyShape[] = {nLabelsA,nLabelsB};
-    contingencyTable.resize(contingencyShape, contingencyShape+2, 0.);
     
-    // compute the contingency matrix
-    tools::forEachCoordinate(shape, [&](const Coord & coord){
-        T labelA = segA(coord.begin());        
-        T labelB = segB(coord.begin());        
-        ++contingencyTable(labelA,labelB);
-    });
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::computeContingecyTable(
+        const andres::View<T> & segA,
+        const andres::View<T> & segB,
+        const int numberOfThreads
+        )
+{
 
-    // compute the sum of rows
-    rowSum.assign( contingencyTable.shape(0), 0.);
-    for( size_t i = 1; i < rowSum.size(); ++i )
-    {
-        for( size_t j = 0; j < contingencyTable.shape(1); ++j )
-        {
-            rowSum[i] += contingencyTable(i,j);
+    tools::ThreadPool threadpool(numberOfThreads);
+    resetContingencyTable();
+    accumulateContingencyTable(threadpool, segA, segB);
+    relabelContingencyTable();
+}
+
+
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::resetContingencyTable()
+{
+    n = 0;
+    contingencyTable.clear();
+    compactTable.clear();
+    hasContingencyTable = false;
+}
+
+
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::accumulateContingencyTable(
+        const andres::View<T> & chunkA,
+        const andres::View<T> & chunkB,
+        const int numberOfThreads
+        )
+{
+    tools::ThreadPool threadpool(numberOfThreads);
+    accumulateContingencyTable(threadpool, chunkA, chunkB);
+}
+
+
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::finalizeContingencyTable()
+{
+    relabelContingencyTable();
+}
+
+
+template<unsigned DIM, class T>
+template<class CHUNK_SOURCE>
+void NeuroMetrics<DIM,T>::computeContingencyTableFromChunks(
+        CHUNK_SOURCE && chunkSource,
+        const int numberOfThreads
+        )
+{
+    tools::ThreadPool threadpool(numberOfThreads);
+    resetContingencyTable();
+
+    // double buffer: one chunk is counted while the other one is read
+    std::array<andres::Marray<T>,2> chunksA, chunksB;
+    auto readChunk = [&](const size_t slot) {
+        return threadpool.enqueueReturning([&, slot](const int tid){
+            return chunkSource(chunksA[slot], chunksB[slot]);
+        });
+    };
+
+    size_t current = 0;
+    bool hasChunk = readChunk(current).get();
+    while(hasChunk) {
+        auto nextChunk = readChunk(1 - current);
+        try {
+            accumulateContingencyTable(threadpool, chunksA[current], chunksB[current]);
         }
-    }
-    
-    // compute the sum of cols
-    colSum.assign(contingencyTable.shape(1), 0.);
-    for( size_t j = 1; j < colSum.size(); ++j )
-    {
-        for( size_t i = 1; i < contingencyTable.shape(0); ++i )
-        {
-            colSum[j] += contingencyTable(i,j);
+        catch(...) {
+            // the next chunk is still read into the buffers, they must outlive the read
+            nextChunk.wait();
+            throw;
         }
+        hasChunk = nextChunk.get();
+        current = 1 - current;
     }
 
-    hasContingencyTable = true;
+    relabelContingencyTable();
 }
 
-    
+
 template<unsigned DIM, class T>
-void NeuroMetrics<DIM,T>::computeContingecyTable(
+void NeuroMetrics<DIM,T>::assignContingencyTable(
+        ContingencyTable & table,
+        const double size
+        )
+{
+    resetContingencyTable();
+    contingencyTable.swap(table);
+    n = size;
+    relabelContingencyTable();
+}
+
+
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::accumulateContingencyTable(
+        tools::ThreadPool & threadpool,
         const andres::View<T> & segA,
-        const andres::View<T> & segB,
-        const int numberOfThreads
+        const andres::View<T> & segB
         )
 {
 
     typedef std::array<int64_t,DIM> Coord;
     
-    n = 1;
+    size_t size = 1;
     Coord shape;
     for(size_t d = 0; d < DIM; ++d) {
+        if(segA.shape(d) != segB.shape(d))
+            throw std::runtime_error("Segmentations must have the same shape");
         shape[d] = segA.shape(d);
-        n *= shape[d];
+        size *= shape[d];
     }
+    if(hasContingencyTable)
+        throw std::runtime_error("Need to call resetContingencyTable before accumulating after finalizeContingencyTable");
+    n += size;
 
-    auto popt = tools::ParallelOptions(numberOfThreads);
-    tools::ThreadPool threadpool(popt);
-    size_t actualNumThreads = threadpool.nThreads();
+    const size_t actualNumThreads = std::max<size_t>(threadpool.nThreads(), 1);
 
-    // max element is super slow here for some reason...
-    T nLabelsA = tools::parallelMax<DIM>(segA, threadpool)+1; 
-    T nLabelsB = tools::parallelMax<DIM>(segB, threadpool)+1; 
+    // blocks of 2^18 voxels: large enough to amortize the task overhead,
+    // small enough to balance the load between the threads
+    const int64_t blockSize = 1 << 18;
 
-    // init the contingency matrix 
-    size_t contingencyShape[] = {nLabelsA,nLabelsB};
-    contingencyTable.resize(contingencyShape, contingencyShape+2, 0.);
-    
-    // parallel
     std::vector<ContingencyTable> cTableThreadVec(actualNumThreads);
-    tools::parallel_foreach(threadpool, actualNumThreads,[&](int tid, int i){
-        cTableThreadVec[tid].resize(contingencyShape, contingencyShape+2, 0.);   
+    const bool contiguous = size > 0 && haveContiguousLayout(segA, segB);
+    const T * labelsA = contiguous ? dataPointer<DIM>(segA) : nullptr;
+    const T * labelsB = contiguous ? dataPointer<DIM>(segB) : nullptr;
+    parallelForEachRange<DIM>(threadpool, shape, contiguous, blockSize,
+    [&](const int tid, const size_t offset, const size_t rangeSize){
+        countOverlaps(labelsA + offset, labelsB + offset, rangeSize, cTableThreadVec[tid]);
+    },
+    [&](const int tid, const Coord & blockBegin, const Coord & blockShape){
+        countOverlaps<DIM>(
+            segA.view(blockBegin.begin(), blockShape.begin()),
+            segB.view(blockBegin.begin(), blockShape.begin()),
+            cTableThreadVec[tid]);
     });
 
-    auto checkCoord = [&](const Coord & coordinate) {
-        for(int d = 0; d < DIM; ++d) {
-            if( coordinate[d] < 0 || coordinate[d] > shape[d]) {
-                std::cout << "DIM " << d << " out of range with " << coordinate[d] << std::endl;
-                throw std::runtime_error("Coordinate out of range");
-            }
-        }
-    };
+    // the running table takes part in the reduction, so the smaller tables are merged into it
+    cTableThreadVec.emplace_back();
+    cTableThreadVec.back().swap(contingencyTable);
+    parallelMerge(threadpool, cTableThreadVec);
+    contingencyTable.swap(cTableThreadVec[0]);
+}
+
+
+template<unsigned DIM, class T>
+const typename NeuroMetrics<DIM,T>::CompactTable &
+NeuroMetrics<DIM,T>::compactContingencyTable() const
+{
+    if(!hasContingencyTable)
+        throw std::runtime_error("Need to call computeContingencyTable first");
+    return compactTable;
+}
 
-    tools::parallelForEachCoordinate(threadpool, shape, [&](const int tid, const Coord & coord){
-        checkCoord(coord);
-        auto & cTable = cTableThreadVec[tid];
-        T labelA = segA(coord.begin());
-        T labelB = segB(coord.begin());
-        ++cTable(labelA,labelB);
+
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::relabelContingencyTable()
+{
+    // row / col sums are sized by the number of segments, label 0 is ignored
+    compactTable.assign(contingencyTable);
+    // the counts live on in the compact table, clear() would keep the hash slots allocated
+    ContingencyTable().swap(contingencyTable);
+
+    randA = 0.; randB = 0.; randAB = 0.;
+    viA = 0.; viB = 0.; viAB = 0.;
+    hasRandPrimitives = false;
+    hasViPrimitives = false;
+    hasSegmentErrors = false;
+    hasContingencyTable = true;
+}
+
+
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::merge(const T labelB1, const T labelB2)
+{
+    if(!hasContingencyTable)
+        throw std::runtime_error("Need to call computeContingencyTable first");
+    if(labelB1 == 0 || labelB2 == 0)
+        throw std::runtime_error("Label 0 can not be edited");
+    // a segment that is not in the table has no elements
+    if(labelB1 == labelB2 || compactTable.colId(labelB2) == compactTable.numberOfCols())
+        return;
+
+    if(!hasRandPrimitives)
+        computeRandPrimitives();
+    if(!hasViPrimitives)
+        computeViPrimitives();
+    hasSegmentErrors = false;
+
+    if(compactTable.colId(labelB1) == compactTable.numberOfCols())
+        compactTable.insertCol(labelB1);
+    const size_t col = compactTable.colId(labelB1);
+    const size_t other = compactTable.colId(labelB2);
+
+    compactTable.mergeCols(col, other, [&](const double oldCount, const double newCount){
+        updateEntryPrimitives(oldCount, newCount);
     });
-    std::cout << "After Ctable" << std::endl;
+    randB = randBPrimitive();
+    viB = viBPrimitive();
+}
 
-    for(int tid = 0; tid < actualNumThreads; ++tid)
-        contingencyTable += cTableThreadVec[tid];
-    std::cout << "After merge" << std::endl;
 
-    
-    // compute the sum of rows
-    rowSum.assign( contingencyTable.shape(0), 0.);
-    for( size_t i = 1; i < rowSum.size(); ++i )
-    {
-        for( size_t j = 0; j < contingencyTable.shape(1); ++j )
-        {
-            rowSum[i] += contingencyTable(i,j);
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::split(
+        const T labelB,
+        const T newLabelB,
+        const std::vector<std::pair<T,double> > & overlap
+        )
+{
+    if(!hasContingencyTable)
+        throw std::runtime_error("Need to call computeContingencyTable first");
+    if(labelB == 0 || newLabelB == 0)
+        throw std::runtime_error("Label 0 can not be edited");
+    if(labelB == newLabelB)
+        throw std::runtime_error("Need a new label for the split segment");
+    const size_t newCol = compactTable.colId(newLabelB);
+    if(newCol != compactTable.numberOfCols()
+            && (compactTable.colSums()[newCol] != 0. || compactTable.colBackgroundSums()[newCol] != 0.))
+        throw std::runtime_error("New label is already in use");
+
+    // the overlap in row ids, sorted and without duplicates.
+    // the elements with label 0 of A do not enter the metrics, they are only counted
+    typename CompactTable::Column rowOverlap;
+    double backgroundCount = 0.;
+    for(const auto & entry : overlap) {
+        if(!(entry.second >= 0.) || std::isinf(entry.second))
+            throw std::runtime_error("Overlap exceeds the entries of the segment");
+        if(entry.second == 0.)
+            continue;
+        if(entry.first == 0) {
+            backgroundCount += entry.second;
+            continue;
         }
+        const size_t row = compactTable.rowId(entry.first);
+        if(row == compactTable.numberOfRows())
+            throw std::runtime_error("Overlap exceeds the entries of the segment");
+        rowOverlap.emplace_back(row, entry.second);
     }
-    
-    // compute the sum of cols
-    colSum.assign(contingencyTable.shape(1), 0.);
-    for( size_t j = 1; j < colSum.size(); ++j )
-    {
-        for( size_t i = 1; i < contingencyTable.shape(0); ++i )
-        {
-            colSum[j] += contingencyTable(i,j);
-        }
+    std::sort(rowOverlap.begin(), rowOverlap.end());
+    size_t nUnique = 0;
+    for(size_t i = 0; i < rowOverlap.size(); ++i) {
+        if(nUnique > 0 && rowOverlap[nUnique - 1].first == rowOverlap[i].first)
+            rowOverlap[nUnique - 1].second += rowOverlap[i].second;
+        else
+            rowOverlap[nUnique++] = rowOverlap[i];
     }
+    rowOverlap.resize(nUnique);
 
-    hasContingencyTable = true;
+    // like a merge, a segment that is not in the table has no elements and only the empty split is valid
+    if(compactTable.colId(labelB) == compactTable.numberOfCols()) {
+        if(!rowOverlap.empty() || backgroundCount > 0.)
+            throw std::runtime_error("Overlap exceeds the entries of the segment");
+        return;
+    }
+    if(rowOverlap.empty() && backgroundCount == 0.)
+        return;
+
+    if(!hasRandPrimitives)
+        computeRandPrimitives();
+    if(!hasViPrimitives)
+        computeViPrimitives();
+    hasSegmentErrors = false;
+
+    if(newCol == compactTable.numberOfCols())
+        compactTable.insertCol(newLabelB);
+    const size_t col = compactTable.colId(labelB);
+    const size_t other = compactTable.colId(newLabelB);
+
+    compactTable.moveEntries(col, other, rowOverlap, backgroundCount, [&](const double oldCount, const double newCount){
+        updateEntryPrimitives(oldCount, newCount);
+    });
+    randB = randBPrimitive();
+    viB = viBPrimitive();
 }
 
 
 template<unsigned DIM, class T>
-void NeuroMetrics<DIM,T>::computeRandPrimitives()
+template<class ITER>
+void NeuroMetrics<DIM,T>::split(
+        const T labelB,
+        const T newLabelB,
+        ITER labelsABegin,
+        ITER labelsAEnd
+        )
 {
-    double aux = 0.;
-    for( size_t i = 1; i < contingencyTable.shape(0) ; i++)
-    {
-        aux += contingencyTable(i,0);
+    // count the moved elements per label of A
+    std::vector<T> labelsA(labelsABegin, labelsAEnd);
+    std::sort(labelsA.begin(), labelsA.end());
+    std::vector<std::pair<T,double> > overlap;
+    for(const T labelA : labelsA) {
+        if(!overlap.empty() && overlap.back().first == labelA)
+            overlap.back().second += 1.;
+        else
+            overlap.emplace_back(labelA, 1.);
     }
+    split(labelB, newLabelB, overlap);
+}
 
-    // sum of square of rows
-    for( size_t i = 0; i < rowSum.size(); i++ )
-    {
-        randA += rowSum[i] * rowSum[i];
-    }
-    
-    // sum of square of cols
-    for( size_t j = 0; j < colSum.size(); j++ )
-    {
-        randB += colSum[j] * colSum[j];
-    }
 
-    randB += aux / n;
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::updateEntryPrimitives(const double oldCount, const double newCount)
+{
+    randAB += newCount * newCount - oldCount * oldCount;
+    viAB += viTerm(newCount) - viTerm(oldCount);
+}
 
-    for( size_t i = 1; i < contingencyTable.shape(0); i++ )
-    {
-        for( size_t j = 1; j < contingencyTable.shape(1); j++ )
-        {
-            randAB += contingencyTable(i,j) * contingencyTable(i,j);
-        }
-    }
 
+template<unsigned DIM, class T>
+double NeuroMetrics<DIM,T>::randBPrimitive() const
+{
+    // sum of square of cols, plus the elements with label 0 in B
+    double ret = 0.;
+    for(const double sum : compactTable.colSums())
+        ret += sum * sum;
+    return ret + compactTable.unlabeledCount() / n;
+}
+
+
+template<unsigned DIM, class T>
+double NeuroMetrics<DIM,T>::viBPrimitive() const
+{
+    // cols emptied by merges do not contribute
+    double ret = 0.;
+    for(const double sum : compactTable.colSums())
+        ret += viTerm(sum);
+    return ret - compactTable.unlabeledCount() / n * log(n);
+}
+
+
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::computeRandPrimitives()
+{
+    // only the non-zero entries contribute, so iterate the compact table directly
+    const double aux = compactTable.unlabeledCount();
+    compactTable.forEachEntry([&](const size_t row, const size_t col, const double count){
+        randAB += count * count;
+    });
+
+    // sum of square of rows
+    for(const double sum : compactTable.rowSums())
+        randA += sum * sum;
+    
+    randB = randBPrimitive();
     randAB += aux / n;
     
     hasRandPrimitives = true;
@@ -309,41 +620,29 @@ double NeuroMetrics<DIM,T>::randScore()
 }
 
 
+template<unsigned DIM, class T>
+double NeuroMetrics<DIM,T>::viTerm(const double count) const
+{
+    if(count == 0.)
+        return 0.;
+    const double p = count / n;
+    return p * log(p);
+}
+
+
 template<unsigned DIM, class T>
 void NeuroMetrics<DIM,T>::computeViPrimitives() {
     
-    double aux = 0.;
-    for( size_t i = 1; i < contingencyTable.shape(0) ; i++)
-    {
-        aux += contingencyTable(i,0);
-    }
-    aux /= n;
+    const double aux = compactTable.unlabeledCount() / n;
+    compactTable.forEachEntry([&](const size_t row, const size_t col, const double count){
+        viAB += viTerm(count);
+    });
 
     // sum of square of rows
-    for( size_t i = 0; i < rowSum.size(); i++ )
-    {
-        if( (rowSum[i] / n) != 0)
-            viA += (rowSum[i] / n) * log( (rowSum[i] / n) );
-    }
+    for(const double sum : compactTable.rowSums())
+        viA += viTerm(sum);
     
-    // sum of square of cols
-    for( size_t j = 0; j < colSum.size(); j++ )
-    {
-        if( (colSum[j] / n) != 0)
-            viB += (colSum[j] / n) * log( (colSum[j] / n) );
-    }
-
-    viB -= aux * log(n);
-
-    for( size_t i = 1; i < contingencyTable.shape(0); i++ )
-    {
-        for( size_t j = 1; j < contingencyTable.shape(1); j++ )
-        {
-            if( (contingencyTable(i,j) / n) != 0)
-                viAB += (contingencyTable(i,j) / n) * log(contingencyTable(i,j) / n);
-        }
-    }
-
+    viB = viBPrimitive();
     viAB -= aux / log(n);
 
     hasViPrimitives = true;
@@ -398,6 +697,118 @@ double NeuroMetrics<DIM,T>::viScore()
     double rec = viRecall();
     return 2. * prec * rec / (prec + rec);
 }
+
+
+template<unsigned DIM, class T>
+void NeuroMetrics<DIM,T>::computeSegmentErrors()
+{
+    const std::vector<double> & rowSums = compactTable.rowSums();
+    const std::vector<double> & colSums = compactTable.colSums();
+    const double nn = n * n;
+
+    // pairs within a segment, minus the pairs that stay together in the other segmentation
+    // fresh vectors, snapshots handed out before keep the old errors
+    auto newRandSplit = std::make_shared<std::vector<double> >(rowSums.size());
+    auto newRandMerge = std::make_shared<std::vector<double> >(colSums.size());
+    auto newViSplit = std::make_shared<std::vector<double> >(rowSums.size(), 0.);
+    auto newViMerge = std::make_shared<std::vector<double> >(colSums.size(), 0.);
+    std::vector<double> & randSplitRef = *newRandSplit;
+    std::vector<double> & randMergeRef = *newRandMerge;
+    std::vector<double> & viSplitRef = *newViSplit;
+    std::vector<double> & viMergeRef = *newViMerge;
+
+    for(size_t row = 0; row < rowSums.size(); ++row)
+        randSplitRef[row] = rowSums[row] * rowSums[row] / nn;
+    for(size_t col = 0; col < colSums.size(); ++col)
+        randMergeRef[col] = colSums[col] * colSums[col] / nn;
+
+    compactTable.forEachEntry([&](const size_t row, const size_t col, const double count){
+        const double p = count / n;
+        viSplitRef[row] += p * log(rowSums[row] / count);
+        viMergeRef[col] += p * log(colSums[col] / count);
+        randSplitRef[row] -= count * count / nn;
+        randMergeRef[col] -= count * count / nn;
+    });
+
+    viSplit = std::move(newViSplit);
+    viMerge = std::move(newViMerge);
+    randSplit = std::move(newRandSplit);
+    randMerge = std::move(newRandMerge);
+
+    hasSegmentErrors = true;
+}
+
+
+template<unsigned DIM, class T>
+const std::vector<double> & NeuroMetrics<DIM,T>::viSplitErrors()
+{
+    return *viSplitErrorsSnapshot();
+}
+
+
+template<unsigned DIM, class T>
+const std::vector<double> & NeuroMetrics<DIM,T>::viMergeErrors()
+{
+    return *viMergeErrorsSnapshot();
+}
+
+
+template<unsigned DIM, class T>
+const std::vector<double> & NeuroMetrics<DIM,T>::randSplitErrors()
+{
+    return *randSplitErrorsSnapshot();
+}
+
+
+template<unsigned DIM, class T>
+const std::vector<double> & NeuroMetrics<DIM,T>::randMergeErrors()
+{
+    return *randMergeErrorsSnapshot();
+}
+
+
+template<unsigned DIM, class T>
+std::shared_ptr<const std::vector<double> > NeuroMetrics<DIM,T>::viSplitErrorsSnapshot()
+{
+    if(!hasContingencyTable)
+        throw std::runtime_error("Need to call computeContingencyTable first");
+    if(!hasSegmentErrors)
+        computeSegmentErrors();
+    return viSplit;
+}
+
+
+template<unsigned DIM, class T>
+std::shared_ptr<const std::vector<double> > NeuroMetrics<DIM,T>::viMergeErrorsSnapshot()
+{
+    if(!hasContingencyTable)
+        throw std::runtime_error("Need to call computeContingencyTable first");
+    if(!hasSegmentErrors)
+        computeSegmentErrors();
+    return viMerge;
+}
+
+
+template<unsigned DIM, class T>
+std::shared_ptr<const std::vector<double> > NeuroMetrics<DIM,T>::randSplitErrorsSnapshot()
+{
+    if(!hasContingencyTable)
+        throw std::runtime_error("Need to call computeContingencyTable first");
+    if(!hasSegmentErrors)
+        computeSegmentErrors();
+    return randSplit;
+}
+
+
+template<unsigned DIM, class T>
+std::shared_ptr<const std::vector<double> > NeuroMetrics<DIM,T>::randMergeErrorsSnapshot()
+{
+    if(!hasContingencyTable)
+        throw std::runtime_error("Need to call computeContingencyTable first");
+    if(!hasSegmentErrors)
+        computeSegmentErrors();
+    return randMerge;
+}
     
 
 } // namespace neurometrics
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+namespace neurometrics{
+namespace tools{
+
+    // hash for integer labels and pairs of integer labels
+    // (splitmix64 finalizer, so consecutive labels spread over the whole table)
+    struct LabelHash {
+
+        static inline uint64_t mix(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9ULL;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111ebULL;
+            x ^= x >> 31;
+            return x;
+        }
+
+        template<class T>
+        inline uint64_t operator()(const T & label) const {
+            return mix(static_cast<uint64_t>(label));
+        }
+
+        template<class T0, class T1>
+        inline uint64_t operator()(const std::pair<T0,T1> & labels) const {
+            return mix(static_cast<uint64_t>(labels.first) * 0x9e3779b97f4a7c15ULL
+                ^ static_cast<uint64_t>(labels.second));
+        }
+    };
+
+
+    // open addressing (linear probing) hash map that accumulates counts per key
+    // the memory scales with the number of distinct keys, not with the key range
+    // a count of 0 marks an empty slot, i.e. zero-valued entries are never stored
+    template<class KEY, class HASH = LabelHash>
+    class CountingHashMap {
+
+    public:
+        typedef KEY KeyType;
+
+        CountingHashMap(const size_t expectedSize = 0)
+            : slots_(), size_(0), mask_(0)
+        {
+            reserve(expectedSize);
+        }
+
+        // add value to the count of key
+        inline void add(const KEY & key, const double value = 1.) {
+            if(value == 0.)
+                return;
+            if(2 * (size_ + 1) > slots_.size())
+                grow();
+            Slot & slot = find(key);
+            if(slot.value == 0.) {
+                slot.key = key;
+                ++size_;
+            }
+            slot.value += value;
+        }
+
+        // count of key, 0 if the key is not present
+        inline double get(const KEY & key) const {
+            if(slots_.empty())
+                return 0.;
+            size_t pos = hash_(key) & mask_;
+            while(slots_[pos].value != 0.) {
+                if(slots_[pos].key == key)
+                    return slots_[pos].value;
+                pos = (pos + 1) & mask_;
+            }
+            return 0.;
+        }
+
+        // add all counts of other to this map
+        void merge(const CountingHashMap & other) {
+            reserve(size_ + other.size_);
+            other.forEach([&](const KEY & key, const double value){
+                add(key, value);
+            });
+        }
+
+        // call f(key, count) for every stored key
+        template<class F>
+        void forEach(F && f) const {
+            for(const auto & slot : slots_) {
+                if(slot.value != 0.)
+                    f(slot.key, slot.value);
+            }
+        }
+
+        // make room for n keys without rehashing
+        void reserve(const size_t n) {
+            size_t capacity = 16;
+            while(capacity < 2 * n)
+                capacity *= 2;
+            if(capacity > slots_.size())
+                rehash(capacity);
+        }
+
+        void clear() {
+            slots_.clear();
+            size_ = 0;
+            mask_ = 0;
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+    private:
+
+        struct Slot {
+            Slot() : key(), value(0.) {}
+            KEY key;
+            double value;
+        };
+
+        inline Slot & find(const KEY & key) {
+            size_t pos = hash_(key) & mask_;
+            while(slots_[pos].value != 0. && !(slots_[pos].key == key))
+                pos = (pos + 1) & mask_;
+            return slots_[pos];
+        }
+
+        void grow() {
+            rehash(slots_.empty() ? 16 : 2 * slots_.size());
+        }
+
+        void rehash(const size_t capacity) {
+            std::vector<Slot> oldSlots(capacity);
+            oldSlots.swap(slots_);
+            mask_ = capacity - 1;
+            for(const auto & slot : oldSlots) {
+                if(slot.value != 0.)
+                    find(slot.key) = slot;
+            }
+        }
+
+        std::vector<Slot> slots_;
+        size_t size_;
+        size_t mask_;
+        HASH hash_;
+    };
+
+} // namespace tools
+} // namespace neurometrics
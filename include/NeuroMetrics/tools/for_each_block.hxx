@@ -2,6 +2,7 @@
 #pragma once
 
 #include <array>
+#include <algorithm>
 
 #include "NeuroMetrics/tools/for_each_coordinate.hxx"
 
@@ -10,6 +11,10 @@ namespace tools{
 
     
     
+    // calls f(tid, blockBegin, blockEnd) for all blocks covering shape,
+    // blocks at the upper border are cropped to the shape
+    // the blocks are distributed over the threads as a flat range, so the load
+    // stays balanced even if there are only few blocks along the first axis
     template<size_t DIM, class SHAPE_T, class BLOCK_SHAPE_T, class F>
     void parallelForEachBlock(
         ThreadPool & threadpool,
@@ -20,17 +25,27 @@ namespace tools{
         typedef std::array<int64_t, DIM> Coord;
         Coord blocksPerAxis, actualblocksShape;
 
+        int64_t numberOfBlocks = 1;
         for(auto d=0; d<DIM; ++d){
+            if(shape[d] == 0)
+                return;
             actualblocksShape[d] = std::min(int64_t(blockShape[d]), int64_t(shape[d]));
             blocksPerAxis[d] = shape[d] / actualblocksShape[d];
+            if(actualblocksShape[d]*blocksPerAxis[d] < shape[d]){
+                ++blocksPerAxis[d];
+            }
+            numberOfBlocks *= blocksPerAxis[d];
         }
 
-        parallelForEachCoordinate(threadpool, blocksPerAxis,
-        [&](const int tid, const Coord & blockCoord){
+        parallel_foreach(threadpool, numberOfBlocks,
+        [&](const int tid, const int64_t blockIndex){
             Coord blockBegin, blockEnd;
-            for(auto d=0; d<DIM; ++d){
-                blockBegin[d] = blockCoord[d] * actualblocksShape[d];
-                blockEnd[d] =  std::min(shape[d], (blockCoord[d] + 1) * blockShape[d]);
+            int64_t rest = blockIndex;
+            for(int d = DIM-1; d >= 0; --d){
+                const int64_t blockCoord = rest % blocksPerAxis[d];
+                rest /= blocksPerAxis[d];
+                blockBegin[d] = blockCoord * actualblocksShape[d];
+                blockEnd[d] =  std::min(int64_t(shape[d]), blockBegin[d] + actualblocksShape[d]);
             }
             f(tid, blockBegin, blockEnd);
         });
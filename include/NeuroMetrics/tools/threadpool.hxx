@@ -357,6 +357,9 @@ inline void parallel_foreach_impl(
             )
         );
     }
+    // the tasks reference f, so all of them have to finish before an exception of one is rethrown
+    for (auto & fut : futures)
+        fut.wait();
     for (auto & fut : futures)
     {
         fut.get();
@@ -411,6 +414,9 @@ inline void parallel_foreach_impl(
         if(workload==0)
             break;
     }
+    // the tasks reference f, so all of them have to finish before an exception of one is rethrown
+    for (auto & fut : futures)
+        fut.wait();
     for (auto & fut : futures)
         fut.get();
 }
@@ -441,6 +447,9 @@ inline void parallel_foreach_impl(
         );
         ++num_items;
     }
+    // the tasks reference f, so all of them have to finish before an exception of one is rethrown
+    for (auto & fut : futures)
+        fut.wait();
     for (auto & fut : futures)
         fut.get();
 }
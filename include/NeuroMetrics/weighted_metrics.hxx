@@ -1,7 +1,162 @@
-// implementing the weighted superpixel metrics from 
+// implementing the weighted superpixel metrics from
 // https://github.com/DerThorsten/inferno/blob/master/include/inferno/learning/loss_functions/variation_of_information.hxx
 // https://github.com/DerThorsten/inferno/blob/master/include/inferno/learning/loss_functions/rand_index.hxx
 
 #pragma once
 
+#include <array>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
 
+#include <andres/marray.hxx>
+
+#include "NeuroMetrics/metrics.hxx"
+#include "NeuroMetrics/contingency_table.hxx"
+#include "NeuroMetrics/tools/for_each_coordinate.hxx"
+#include "NeuroMetrics/tools/threadpool.hxx"
+
+namespace neurometrics {
+
+// weighted contingency table: every element adds its weight to the overlap of its labels instead of 1.
+// the elements are e.g. superpixels weighted by their size, or voxels weighted by a mask
+// (boundary down-weighting). the weights must be non-negative and finite, the counting throws otherwise:
+// weights that cancel to a zero overlap would be taken for empty slots of the hash map.
+// the rand and vi measures are then computed by NeuroMetrics from the weighted table,
+// with the total weight taking the place of the number of elements
+
+
+inline void checkWeight(const double weight) {
+    if(!(weight >= 0.) || std::isinf(weight))
+        throw std::runtime_error("Weights must be non-negative and finite");
+}
+
+
+// count the weighted overlaps of two label arrays in contiguous memory into table,
+// runs of identical pairs are counted with a single table update.
+// returns the total weight
+template<class T, class W>
+double countWeightedOverlaps(
+        const T * labelsA,
+        const T * labelsB,
+        const W * weights,
+        const size_t size,
+        SparseContingencyTable<T> & table)
+{
+    if(size == 0)
+        return 0.;
+    double totalWeight = 0.;
+    T runA = labelsA[0];
+    T runB = labelsB[0];
+    double runWeight = 0.;
+    for(size_t i = 0; i < size; ++i) {
+        if(labelsA[i] != runA || labelsB[i] != runB) {
+            table.add(runA, runB, runWeight);
+            totalWeight += runWeight;
+            runA = labelsA[i];
+            runB = labelsB[i];
+            runWeight = 0.;
+        }
+        const double weight = weights[i];
+        checkWeight(weight);
+        runWeight += weight;
+    }
+    table.add(runA, runB, runWeight);
+    return totalWeight + runWeight;
+}
+
+
+// count the weighted overlaps of two views with the same shape into table,
+// generic path: strided access via the coordinates of each element.
+// returns the total weight
+template<unsigned DIM, class T, class W>
+double countWeightedOverlapsStrided(
+        const andres::View<T> & segA,
+        const andres::View<T> & segB,
+        const andres::View<W> & weights,
+        SparseContingencyTable<T> & table)
+{
+    typedef std::array<int64_t,DIM> Coord;
+
+    Coord shape;
+    for(size_t d = 0; d < DIM; ++d)
+        shape[d] = segA.shape(d);
+
+    double totalWeight = 0.;
+    tools::forEachCoordinate(shape, [&](const Coord & coord){
+        const double weight = weights(coord.begin());
+        checkWeight(weight);
+        table.add(segA(coord.begin()), segB(coord.begin()), weight);
+        totalWeight += weight;
+    });
+    return totalWeight;
+}
+
+
+// true if the segmentations and the weights are unstrided with the same memory order
+template<class T, class W>
+inline bool haveContiguousLayout(
+        const andres::View<T> & segA,
+        const andres::View<T> & segB,
+        const andres::View<W> & weights) {
+    return haveContiguousLayout(segA, segB)
+        && weights.isSimple() && weights.coordinateOrder() == segA.coordinateOrder();
+}
+
+
+// compute the weighted contingency table of segA and segB and hand it to metrics,
+// parallelized like the unweighted table, see parallelForEachRange
+template<unsigned DIM, class T, class W>
+void computeWeightedContingencyTable(
+        NeuroMetrics<DIM,T> & metrics,
+        const andres::View<T> & segA,
+        const andres::View<T> & segB,
+        const andres::View<W> & weights,
+        const int numberOfThreads = -1
+        )
+{
+
+    typedef std::array<int64_t,DIM> Coord;
+    typedef SparseContingencyTable<T> ContingencyTable;
+
+    size_t size = 1;
+    Coord shape;
+    for(size_t d = 0; d < DIM; ++d) {
+        if(segA.shape(d) != segB.shape(d) || segA.shape(d) != weights.shape(d))
+            throw std::runtime_error("Segmentations and weights must have the same shape");
+        shape[d] = segA.shape(d);
+        size *= shape[d];
+    }
+
+    tools::ThreadPool threadpool(numberOfThreads);
+    const size_t actualNumThreads = std::max<size_t>(threadpool.nThreads(), 1);
+
+    const int64_t blockSize = 1 << 18;
+
+    std::vector<ContingencyTable> cTableThreadVec(actualNumThreads);
+    std::vector<double> weightThreadVec(actualNumThreads, 0.);
+    const bool contiguous = size > 0 && haveContiguousLayout(segA, segB, weights);
+    const T * labelsA = contiguous ? dataPointer<DIM>(segA) : nullptr;
+    const T * labelsB = contiguous ? dataPointer<DIM>(segB) : nullptr;
+    const W * weightsPtr = contiguous ? dataPointer<DIM>(weights) : nullptr;
+    parallelForEachRange<DIM>(threadpool, shape, contiguous, blockSize,
+    [&](const int tid, const size_t offset, const size_t rangeSize){
+        weightThreadVec[tid] += countWeightedOverlaps(
+            labelsA + offset, labelsB + offset, weightsPtr + offset, rangeSize, cTableThreadVec[tid]);
+    },
+    [&](const int tid, const Coord & blockBegin, const Coord & blockShape){
+        weightThreadVec[tid] += countWeightedOverlapsStrided<DIM>(
+            segA.view(blockBegin.begin(), blockShape.begin()),
+            segB.view(blockBegin.begin(), blockShape.begin()),
+            weights.view(blockBegin.begin(), blockShape.begin()),
+            cTableThreadVec[tid]);
+    });
+
+    parallelMerge(threadpool, cTableThreadVec);
+    const double totalWeight = std::accumulate(weightThreadVec.begin(), weightThreadVec.end(), 0.);
+    metrics.assignContingencyTable(cTableThreadVec[0], totalWeight);
+}
+
+} // namespace neurometrics
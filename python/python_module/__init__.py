@@ -3,32 +3,67 @@ import numpy as np
 from . _NeuroMetrics import *
 
 
-def metrics(gt, seg):
-    gtType  = gt.dtype
-    segType = seg.dtype
-    assert gtType == segType, "Inputs must have the same data type!"
-    assert gt.shape == seg.shape, "Inputs must have the same shape!"
-    dim = gt.ndim
-    if gtType == np.uint32:
+def _metricsClass(dtype, dim):
+    if dtype == np.uint32:
         if dim == 1:
-            m = Metrics1dUInt32()
+            return Metrics1dUInt32
         elif dim == 2:
-            m = Metrics2dUInt32()
+            return Metrics2dUInt32
         elif dim == 3:
-            m = Metrics3dUInt32()
+            return Metrics3dUInt32
         else:
             raise AttributeError("Only up to 3 dimensional input is supported")
-    elif gtType == np.uint64:
+    elif dtype == np.uint64:
         if dim == 1:
-            m = Metrics1dUInt64()
+            return Metrics1dUInt64
         elif dim == 2:
-            m = Metrics2dUInt64()
+            return Metrics2dUInt64
         elif dim == 3:
-            m = Metrics3dUInt64()
+            return Metrics3dUInt64
         else:
             raise AttributeError("Only up to 3 dimensional input is supported")
     else:
-        raise AttributeError("Datatype %s not supported" % str(gtType))
+        raise AttributeError("Datatype %s not supported" % str(dtype))
+
 
-    m.computeContingencyTable(gt, seg)
+def metrics(gt, seg, numberOfThreads=-1):
+    gtType  = gt.dtype
+    segType = seg.dtype
+    assert gtType == segType, "Inputs must have the same data type!"
+    assert gt.shape == seg.shape, "Inputs must have the same shape!"
+    m = _metricsClass(gtType, gt.ndim)()
+    m.computeContingencyTable(gt, seg, numberOfThreads)
     return m
+
+
+# weighted metrics: every element counts with its weight instead of 1,
+# e.g. gt and seg are labels of superpixels and weights their sizes, or weights is a voxel weight mask
+def weightedMetrics(gt, seg, weights, numberOfThreads=-1):
+    gtType  = gt.dtype
+    segType = seg.dtype
+    assert gtType == segType, "Inputs must have the same data type!"
+    assert gt.shape == seg.shape, "Inputs must have the same shape!"
+    assert gt.shape == weights.shape, "Weights must have the same shape as the inputs!"
+    m = _metricsClass(gtType, gt.ndim)()
+    m.computeWeightedContingencyTable(gt, seg, weights, numberOfThreads)
+    return m
+
+
+# chunks: iterable of aligned (gtChunk, segChunk) arrays, e.g. blocks of np.memmap'ed raw files
+# only two chunks are held in memory at a time
+def metricsFromChunks(chunks, dtype, ndim, numberOfThreads=-1):
+    m = _metricsClass(np.dtype(dtype), ndim)()
+    m.computeContingencyTableFromChunks(chunks, numberOfThreads)
+    return m
+
+
+# evaluate many candidate segmentations against the same ground truth in one pass over it
+# candidates: list of arrays or an array stacked along the first axis
+# returns an array with one row per candidate and the columns
+# randIndex, randPrecision, randRecall, randScore, variationOfInformation, viPrecision, viRecall, viScore
+def batchedMetrics(gt, candidates, numberOfThreads=-1):
+    candidates = list(candidates)
+    for seg in candidates:
+        assert gt.dtype == seg.dtype, "Inputs must have the same data type!"
+        assert gt.shape == seg.shape, "Inputs must have the same shape!"
+    return _metricsClass(gt.dtype, gt.ndim).batchedMetrics(gt, candidates, numberOfThreads)
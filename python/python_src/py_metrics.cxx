@@ -3,15 +3,95 @@
 #include <pybind11/stl.h>
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
 
 #include "NeuroMetrics/metrics.hxx"
+#include "NeuroMetrics/batched_metrics.hxx"
+#include "NeuroMetrics/weighted_metrics.hxx"
 #include "NeuroMetrics/converter.hxx"
+#include "NeuroMetrics/tools/for_each_coordinate.hxx"
 
 namespace py = pybind11;
 
 namespace neurometrics {
 
 
+// copy a numpy chunk into an owned buffer, so the chunk can be counted after python has released it.
+// contiguous chunks (e.g. slices of a c-order memmap) are copied with a single memcpy,
+// only other layouts take the strided copy
+template<unsigned DIM, class T>
+void copyChunk(const andres::View<T> & chunk, andres::Marray<T> & buffer) {
+    typedef std::array<int64_t,DIM> Coord;
+    Coord shape;
+    for(size_t d = 0; d < DIM; ++d)
+        shape[d] = chunk.shape(d);
+    buffer.resize(shape.begin(), shape.end());
+    if(chunk.size() == 0)
+        return;
+    if(haveContiguousLayout(chunk, andres::View<T>(buffer))) {
+        std::memcpy(&buffer(0), dataPointer<DIM>(chunk), chunk.size() * sizeof(T));
+        return;
+    }
+    tools::forEachCoordinate(shape, [&](const Coord & coord){
+        buffer(coord.begin()) = chunk(coord.begin());
+    });
+}
+
+
+// read-only numpy array on the buffer of an immutable vector, without copying it.
+// the capsule holds a reference to the vector, so the array stays valid after the owner of
+// the vector has replaced or dropped it
+template<class V>
+py::array_t<V> sharedArray(const std::shared_ptr<const std::vector<V> > & vec) {
+    auto shared = new std::shared_ptr<const std::vector<V> >(vec);
+    py::capsule releaseShared(shared, [](void * ptr){
+        delete reinterpret_cast<std::shared_ptr<const std::vector<V> > *>(ptr);
+    });
+    py::array_t<V> array({vec->size()}, {sizeof(V)}, vec->data(), releaseShared);
+    array.attr("setflags")(py::arg("write") = false);
+    return array;
+}
+
+
+// read-only numpy array on a copy of vec, for vectors that are edited in place
+template<class V>
+py::array_t<V> copiedArray(const std::vector<V> & vec) {
+    return sharedArray(std::make_shared<const std::vector<V> >(vec));
+}
+
+
+// labels and errors of the k segments with the largest errors, sorted by decreasing error
+template<class T>
+py::tuple largestErrorsWithLabels(const std::vector<T> & labels, const std::vector<double> & errors, const size_t k) {
+    const std::vector<size_t> ids = largestErrors(errors, k);
+    py::array_t<T> worstLabels(ids.size());
+    py::array_t<double> worstErrors(ids.size());
+    auto labelsAccess = worstLabels.template mutable_unchecked<1>();
+    auto errorsAccess = worstErrors.template mutable_unchecked<1>();
+    for(size_t i = 0; i < ids.size(); ++i) {
+        labelsAccess(i) = labels[ids[i]];
+        errorsAccess(i) = errors[ids[i]];
+    }
+    return py::make_tuple(worstLabels, worstErrors);
+}
+
+
+template<unsigned DIM, class T, class W>
+void weightedContingencyTable(
+        NeuroMetrics<DIM,T> & self,
+        andres::PyView<T,DIM> segA,
+        andres::PyView<T,DIM> segB,
+        andres::PyView<W,DIM> weights,
+        const int numberOfThreads){
+    {
+        py::gil_scoped_release allowThreads;
+        computeWeightedContingencyTable<DIM>(self, segA, segB, weights, numberOfThreads);
+    }
+}
+
+
 template<unsigned DIM, class T>
 void exportMetricsT(py::module & metricsModule, std::string & cls_name){
 
@@ -21,12 +101,138 @@ void exportMetricsT(py::module & metricsModule, std::string & cls_name){
         .def(py::init<>())
         .def("computeContingencyTable",[](Metrics & self, 
             andres::PyView<T,DIM> segA,
-            andres::PyView<T,DIM> segB){
+            andres::PyView<T,DIM> segB,
+            const int numberOfThreads){
                 {
                     py::gil_scoped_release allowThreads;
-                    self.computeContingecyTable(segA, segB);
+                    self.computeContingecyTable(segA, segB, numberOfThreads);
                 }
+        }, py::arg("segA"), py::arg("segB"), py::arg("numberOfThreads") = -1)
+        // every element counts with its weight, e.g. superpixel sizes or a voxel weight mask.
+        // float32 and float64 weights are used without a copy, the float32 overload comes first,
+        // so that other dtypes (e.g. uint8 masks) are converted to the smaller type
+        .def("computeWeightedContingencyTable", &weightedContingencyTable<DIM,T,float>,
+            py::arg("segA"), py::arg("segB"), py::arg("weights"), py::arg("numberOfThreads") = -1)
+        .def("computeWeightedContingencyTable", &weightedContingencyTable<DIM,T,double>,
+            py::arg("segA"), py::arg("segB"), py::arg("weights"), py::arg("numberOfThreads") = -1)
+        .def("resetContingencyTable", &Metrics::resetContingencyTable)
+        .def("accumulateContingencyTable",[](Metrics & self, 
+            andres::PyView<T,DIM> chunkA,
+            andres::PyView<T,DIM> chunkB,
+            const int numberOfThreads){
+                {
+                    py::gil_scoped_release allowThreads;
+                    self.accumulateContingencyTable(chunkA, chunkB, numberOfThreads);
+                }
+        }, py::arg("chunkA"), py::arg("chunkB"), py::arg("numberOfThreads") = -1)
+        .def("finalizeContingencyTable", &Metrics::finalizeContingencyTable)
+        // chunks: iterable yielding aligned (chunkA, chunkB) numpy arrays,
+        // e.g. slices of np.memmap'ed raw files.
+        // the chunks are copied into the two buffers of the C++ stream, so while a pair is read
+        // the numpy pair is held in addition: at peak three chunk pairs are in memory
+        .def("computeContingencyTableFromChunks",[](Metrics & self, 
+            py::iterable chunks,
+            const int numberOfThreads){
+                py::iterator it = py::iter(chunks);
+                // called from a worker thread, needs to grab the gil for the python iterator
+                auto chunkSource = [&](andres::Marray<T> & chunkA, andres::Marray<T> & chunkB){
+                    py::gil_scoped_acquire acquireGil;
+                    if(it == py::iterator::sentinel())
+                        return false;
+                    auto chunkPair = py::reinterpret_borrow<py::sequence>(*it);
+                    const auto pyChunkA = chunkPair[0].cast<andres::PyView<T,DIM> >();
+                    const auto pyChunkB = chunkPair[1].cast<andres::PyView<T,DIM> >();
+                    ++it;
+                    // the views keep the numpy arrays alive, so other python threads can run during the copy
+                    {
+                        py::gil_scoped_release allowThreads;
+                        copyChunk<DIM>(pyChunkA, chunkA);
+                        copyChunk<DIM>(pyChunkB, chunkB);
+                    }
+                    return true;
+                };
+                {
+                    py::gil_scoped_release allowThreads;
+                    self.computeContingencyTableFromChunks(chunkSource, numberOfThreads);
+                }
+        }, py::arg("chunks"), py::arg("numberOfThreads") = -1)
+        // mapping from the consecutive row / col ids to the original labels,
+        // the arrays are read-only copies: merges and splits edit these vectors in place
+        .def("rowLabels", [](const Metrics & self){
+            return copiedArray(self.compactContingencyTable().rowLabels());
+        })
+        .def("colLabels", [](const Metrics & self){
+            return copiedArray(self.compactContingencyTable().colLabels());
+        })
+        .def("rowSums", [](const Metrics & self){
+            return copiedArray(self.compactContingencyTable().rowSums());
+        })
+        .def("colSums", [](const Metrics & self){
+            return copiedArray(self.compactContingencyTable().colSums());
+        })
+        // evaluate a list of candidate segmentations against one ground truth,
+        // returns an array of shape (len(candidates), 8) with the columns
+        // randIndex, randPrecision, randRecall, randScore,
+        // variationOfInformation, viPrecision, viRecall, viScore
+        .def_static("batchedMetrics",[](
+            andres::PyView<T,DIM> gt,
+            std::vector<andres::PyView<T,DIM> > candidates,
+            const int numberOfThreads){
+                // plain views, copying them does not touch python refcounts when the gil is released
+                std::vector<andres::View<T> > candidateViews(candidates.begin(), candidates.end());
+                const size_t shape[] = {candidates.size(), size_t(NumberOfBatchedMetrics)};
+                andres::PyView<double,2> results(shape, shape + 2);
+                {
+                    py::gil_scoped_release allowThreads;
+                    batchedMetrics<DIM>(gt, candidateViews, results, numberOfThreads);
+                }
+                return results;
+        }, py::arg("gt"), py::arg("candidates"), py::arg("numberOfThreads") = -1)
+        // incremental updates after merges / splits of segments in segB
+        .def("merge", &Metrics::merge, py::arg("labelB1"), py::arg("labelB2"))
+        // labelsA: labels of segA at the elements that move from labelB to newLabelB
+        .def("split",[](Metrics & self, const T labelB, const T newLabelB,
+            andres::PyView<T,1> labelsA){
+                const andres::View<T> & labels = labelsA;
+                {
+                    py::gil_scoped_release allowThreads;
+                    self.split(labelB, newLabelB, labels.begin(), labels.end());
+                }
+        }, py::arg("labelB"), py::arg("newLabelB"), py::arg("labelsA"))
+        // overlapLabels, overlapCounts: number of moved elements per label of segA
+        .def("split",[](Metrics & self, const T labelB, const T newLabelB,
+            andres::PyView<T,1> overlapLabels,
+            andres::PyView<double,1> overlapCounts){
+                if(overlapLabels.size() != overlapCounts.size())
+                    throw std::runtime_error("Overlap labels and counts must have the same size");
+                std::vector<std::pair<T,double> > overlap;
+                for(size_t i = 0; i < overlapLabels.size(); ++i)
+                    overlap.emplace_back(overlapLabels(i), overlapCounts(i));
+                self.split(labelB, newLabelB, overlap);
+        }, py::arg("labelB"), py::arg("newLabelB"), py::arg("overlapLabels"), py::arg("overlapCounts"))
+        // per segment errors, indexed like rowLabels (splits) / colLabels (merges).
+        // read-only arrays on the error snapshots, not copied
+        .def("viSplitErrors", [](Metrics & self){
+            return sharedArray(self.viSplitErrorsSnapshot());
+        })
+        .def("viMergeErrors", [](Metrics & self){
+            return sharedArray(self.viMergeErrorsSnapshot());
+        })
+        .def("randSplitErrors", [](Metrics & self){
+            return sharedArray(self.randSplitErrorsSnapshot());
+        })
+        .def("randMergeErrors", [](Metrics & self){
+            return sharedArray(self.randMergeErrorsSnapshot());
         })
+        // (labels, errors) of the k segments of segA / segB with the largest vi (or rand) errors
+        .def("worstSplits", [](Metrics & self, const size_t k, const bool useVi){
+            const auto & errors = useVi ? self.viSplitErrors() : self.randSplitErrors();
+            return largestErrorsWithLabels(self.compactContingencyTable().rowLabels(), errors, k);
+        }, py::arg("k"), py::arg("useVi") = true)
+        .def("worstMerges", [](Metrics & self, const size_t k, const bool useVi){
+            const auto & errors = useVi ? self.viMergeErrors() : self.randMergeErrors();
+            return largestErrorsWithLabels(self.compactContingencyTable().colLabels(), errors, k);
+        }, py::arg("k"), py::arg("useVi") = true)
         .def("randIndex", &Metrics::randIndex)
         .def("randScore", &Metrics::randScore)
         .def("randPrecision", &Metrics::randPrecision)
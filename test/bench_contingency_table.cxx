@@ -0,0 +1,58 @@
+// benchmark of the overlap counting kernels:
+// strided per-coordinate access (before) vs. the linear pass over contiguous memory (after)
+
+#include <array>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include <andres/marray.hxx>
+
+#include "NeuroMetrics/contingency_table.hxx"
+#include "generate_test_data.hxx"
+#include "bench_timing.hxx"
+
+using namespace neurometrics;
+
+template<class T, unsigned DIM>
+void benchmarkKernels(const std::array<size_t,DIM> & shape, const std::string & name) {
+
+    auto segA = generateTestSegmentation<T,DIM>(shape, T(1000), 32);
+    auto segB = generateTestSegmentation<T,DIM>(shape, T(5000), 50);
+    const andres::View<T> & viewA = segA;
+    const andres::View<T> & viewB = segB;
+    const double size = viewA.size();
+
+    const double tStrided = timeKernel([&](){
+        SparseContingencyTable<T> table;
+        countOverlapsStrided<DIM>(viewA, viewB, table);
+    });
+    const double tContiguous = timeKernel([&](){
+        SparseContingencyTable<T> table;
+        countOverlaps<DIM>(viewA, viewB, table);
+    });
+
+    // precision per column, the stream keeps it for the following rows
+    std::cout << std::left << std::setw(14) << name
+        << std::right << std::setprecision(6) << std::setw(16) << size / tStrided
+        << std::setw(16) << size / tContiguous
+        << std::setw(10) << std::setprecision(3) << tStrided / tContiguous << "x"
+        << std::endl;
+}
+
+int main() {
+
+    std::cout << std::left << std::setw(14) << "input"
+        << std::right << std::setw(16) << "strided vx/s"
+        << std::setw(16) << "linear vx/s"
+        << std::setw(11) << "speedup" << std::endl;
+
+    benchmarkKernels<uint32_t,1>({{size_t(1) << 24}}, "1d uint32");
+    benchmarkKernels<uint64_t,1>({{size_t(1) << 24}}, "1d uint64");
+    benchmarkKernels<uint32_t,2>({{4096, 4096}}, "2d uint32");
+    benchmarkKernels<uint64_t,2>({{4096, 4096}}, "2d uint64");
+    benchmarkKernels<uint32_t,3>({{256, 256, 256}}, "3d uint32");
+    benchmarkKernels<uint64_t,3>({{256, 256, 256}}, "3d uint64");
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+// benchmark of the metrics engines across shapes, label counts, dtypes and thread counts.
+// every case is written as one json object per line, to stdout or to the file given as first argument,
+// so that runs of different versions can be compared with compare_benchmarks.py
+
+#include <array>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+#include <andres/marray.hxx>
+
+#include "NeuroMetrics/metrics.hxx"
+#include "NeuroMetrics/batched_metrics.hxx"
+#include "generate_test_data.hxx"
+#include "bench_timing.hxx"
+
+using namespace neurometrics;
+
+// value of a field of /proc/self/status in kB, -1 if it is not available (non linux systems)
+long readProcStatus(const std::string & field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while(std::getline(status, line)) {
+        if(line.compare(0, field.size() + 1, field + ":") == 0)
+            return std::stol(line.substr(field.size() + 1));
+    }
+    return -1;
+}
+
+// peak memory of a run of f on top of the memory in use before it, in kB.
+// resets the peak resident set size of the process (linux >= 4.0), so the runs are measured separately
+template<class F>
+long peakMemory(F && f) {
+    {
+        std::ofstream clearRefs("/proc/self/clear_refs");
+        clearRefs << "5";
+    }
+    const long before = readProcStatus("VmRSS");
+    f();
+    const long peak = readProcStatus("VmHWM");
+    return (before < 0 || peak < 0) ? -1 : peak - before;
+}
+
+template<class T> std::string dtypeName();
+template<> std::string dtypeName<uint32_t>() { return "uint32"; }
+template<> std::string dtypeName<uint64_t>() { return "uint64"; }
+
+template<size_t DIM>
+std::string shapeString(const std::array<size_t,DIM> & shape) {
+    std::stringstream ss;
+    ss << "[";
+    for(size_t d = 0; d < DIM; ++d)
+        ss << (d > 0 ? ", " : "") << shape[d];
+    ss << "]";
+    return ss.str();
+}
+
+struct BenchmarkWriter {
+    std::ostream & out;
+
+    template<size_t DIM>
+    void write(const std::string & engine, const std::string & dtype, const std::array<size_t,DIM> & shape,
+            const size_t numberOfLabels, const int numberOfThreads, const double numberOfVoxels,
+            const double seconds, const long peakMemoryKb) {
+        out << "{\"engine\": \"" << engine << "\""
+            << ", \"dtype\": \"" << dtype << "\""
+            << ", \"shape\": " << shapeString(shape)
+            << ", \"labels\": " << numberOfLabels
+            << ", \"threads\": " << numberOfThreads
+            << ", \"seconds\": " << seconds
+            << ", \"voxels_per_second\": " << numberOfVoxels / seconds
+            << ", \"peak_memory_kb\": " << peakMemoryKb
+            << "}" << std::endl;
+    }
+};
+
+template<class T, unsigned DIM>
+void benchmarkMetrics(BenchmarkWriter & writer, const std::array<size_t,DIM> & shape,
+        const size_t numberOfLabels, const std::vector<int> & threadCounts) {
+
+    auto segA = generateTestSegmentation<T,DIM>(shape, T(numberOfLabels), 32, 1);
+    auto segB = generateTestSegmentation<T,DIM>(shape, T(4 * numberOfLabels), 16, 2);
+    const double size = segA.size();
+
+    for(const int numberOfThreads : threadCounts) {
+        auto run = [&](){
+            NeuroMetrics<DIM,T> m;
+            m.computeContingecyTable(segA, segB, numberOfThreads);
+            m.randScore();
+            m.viScore();
+        };
+        const double seconds = timeKernel(run);
+        writer.write("threaded", dtypeName<T>(), shape, numberOfLabels, numberOfThreads,
+            size, seconds, peakMemory(run));
+    }
+
+    // 8 candidates against the same ground truth, throughput in ground truth voxels per candidate
+    const size_t numberOfCandidates = 8;
+    std::vector<andres::Marray<T> > candidates;
+    for(size_t i = 0; i < numberOfCandidates; ++i)
+        candidates.push_back(generateTestSegmentation<T,DIM>(shape, T(4 * numberOfLabels), 16 + i, 3 + i));
+    const std::vector<andres::View<T> > candidateViews(candidates.begin(), candidates.end());
+    const size_t resultShape[] = {numberOfCandidates, size_t(NumberOfBatchedMetrics)};
+    andres::Marray<double> results(resultShape, resultShape + 2);
+    for(const int numberOfThreads : threadCounts) {
+        auto run = [&](){
+            batchedMetrics<DIM>(segA, candidateViews, results, numberOfThreads);
+        };
+        const double seconds = timeKernel(run);
+        writer.write("batched8", dtypeName<T>(), shape, numberOfLabels, numberOfThreads,
+            size * numberOfCandidates, seconds, peakMemory(run));
+    }
+}
+
+int main(int argc, char ** argv) {
+
+    std::ofstream outFile;
+    if(argc > 1)
+        outFile.open(argv[1]);
+    BenchmarkWriter writer{argc > 1 ? outFile : std::cout};
+
+    const int hardwareThreads = std::max<int>(std::thread::hardware_concurrency(), 1);
+    std::vector<int> threadCounts = {1, 2, 4, hardwareThreads};
+    std::sort(threadCounts.begin(), threadCounts.end());
+    threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+    for(const size_t numberOfLabels : {size_t(1000), size_t(100000)}) {
+        benchmarkMetrics<uint32_t,2>(writer, {{4096, 4096}}, numberOfLabels, threadCounts);
+        benchmarkMetrics<uint64_t,2>(writer, {{4096, 4096}}, numberOfLabels, threadCounts);
+        benchmarkMetrics<uint32_t,3>(writer, {{128, 128, 128}}, numberOfLabels, threadCounts);
+        benchmarkMetrics<uint64_t,3>(writer, {{128, 128, 128}}, numberOfLabels, threadCounts);
+        benchmarkMetrics<uint32_t,3>(writer, {{256, 256, 256}}, numberOfLabels, threadCounts);
+        benchmarkMetrics<uint64_t,3>(writer, {{256, 256, 256}}, numberOfLabels, threadCounts);
+    }
+
+    return 0;
+}
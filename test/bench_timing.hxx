@@ -0,0 +1,19 @@
+// timing helper shared by the benchmarks
+#pragma once
+
+#include <chrono>
+#include <limits>
+#include <algorithm>
+
+// best wall clock time of several repetitions in seconds
+template<class F>
+double timeKernel(F && f, const size_t repetitions = 3) {
+    double best = std::numeric_limits<double>::max();
+    for(size_t r = 0; r < repetitions; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
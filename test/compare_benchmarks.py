@@ -0,0 +1,50 @@
+# compare two runs of bench_metrics (json lines) and report the cases that got slower
+# or use more memory than the tolerance allows
+# usage: python compare_benchmarks.py baseline.jsonl current.jsonl [tolerance]
+# exits with 1 if there is a regression
+
+import json
+import sys
+
+
+def _load(path):
+    cases = {}
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            case = json.loads(line)
+            key = (case["engine"], case["dtype"], tuple(case["shape"]), case["labels"], case["threads"])
+            cases[key] = case
+    return cases
+
+
+def compare(baselinePath, currentPath, tolerance=0.1):
+    baseline = _load(baselinePath)
+    current = _load(currentPath)
+    regressions = 0
+    for key in sorted(baseline):
+        if key not in current:
+            print("missing   %s" % str(key))
+            continue
+        old, new = baseline[key], current[key]
+        speedup = new["voxels_per_second"] / old["voxels_per_second"]
+        status = "ok"
+        if speedup < 1. - tolerance:
+            status = "SLOWER"
+            regressions += 1
+        elif old["peak_memory_kb"] > 0 and new["peak_memory_kb"] > (1. + tolerance) * old["peak_memory_kb"]:
+            status = "MEMORY"
+            regressions += 1
+        print("%-9s %s  throughput x%.3f  memory %d -> %d kB" % (
+            status, str(key), speedup, old["peak_memory_kb"], new["peak_memory_kb"]))
+    return regressions
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 3:
+        print("usage: python compare_benchmarks.py baseline.jsonl current.jsonl [tolerance]")
+        sys.exit(2)
+    tolerance = float(sys.argv[3]) if len(sys.argv) > 3 else 0.1
+    sys.exit(1 if compare(sys.argv[1], sys.argv[2], tolerance) > 0 else 0)
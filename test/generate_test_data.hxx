@@ -1,18 +1,21 @@
 // TODO refactor this to some other place
+#pragma once
 
 #include <array>
 #include <random>
+#include <functional>
 
 #include <andres/marray.hxx>
 
 template<class T, unsigned DIM>
 andres::Marray<T> generateTestSegmentation(const std::array<size_t,DIM> & shape,
         const T segRange,
-        const size_t maxSegmentLen) {
+        const size_t maxSegmentLen,
+        const unsigned seed = std::default_random_engine::default_seed) {
    
     andres::Marray<T> ret(shape.begin(),shape.end());
 
-    std::default_random_engine generator;
+    std::default_random_engine generator(seed);
     
     std::uniform_int_distribution<T> valueDistribution(0,segRange);
     auto drawSegVal = std::bind(valueDistribution,generator);
@@ -29,7 +32,7 @@ andres::Marray<T> generateTestSegmentation(const std::array<size_t,DIM> & shape,
         for(size_t i = 0; i < len; ++i) {
             *it = val;
             ++it;
-            if it == ret.end()
+            if(it == ret.end())
                 break;
         }
     }
@@ -0,0 +1,80 @@
+// reference oracle for the tests:
+// contingency table in a std::map and the metric definitions of metrics.hxx written out directly.
+// O(n log n), so it can check volumes that are too large for the brute force code
+
+#pragma once
+
+#include <array>
+#include <map>
+#include <utility>
+#include <iterator>
+#include <cmath>
+
+// metrics in the order of neurometrics::BatchedMetric:
+// randIndex, randPrecision, randRecall, randScore,
+// variationOfInformation, viPrecision, viRecall, viScore
+typedef std::array<double,8> MetricValues;
+
+// weights: one weight per element, nullptr counts every element with 1
+template<class ITERATOR_0, class ITERATOR_1>
+MetricValues referenceMetrics(
+        ITERATOR_0 begin0,
+        ITERATOR_0 end0,
+        ITERATOR_1 begin1,
+        const double * weights = nullptr) {
+
+    typedef typename std::iterator_traits<ITERATOR_0>::value_type Label0;
+    typedef typename std::iterator_traits<ITERATOR_1>::value_type Label1;
+
+    // label 0 of the first partition is ignored,
+    // the overlap with label 0 of the second partition is only kept as a total
+    std::map<std::pair<Label0,Label1>, double> overlaps;
+    std::map<Label0, double> rowSums;
+    std::map<Label1, double> colSums;
+    double n = 0.;
+    double unlabeled = 0.;
+    for(size_t i = 0; begin0 != end0; ++begin0, ++begin1, ++i) {
+        const double weight = weights == nullptr ? 1. : weights[i];
+        n += weight;
+        if(*begin0 == Label0())
+            continue;
+        rowSums[*begin0] += weight;
+        if(*begin1 == Label1()) {
+            unlabeled += weight;
+            continue;
+        }
+        colSums[*begin1] += weight;
+        overlaps[std::make_pair(*begin0, *begin1)] += weight;
+    }
+
+    auto plogp = [&](const double count) {
+        const double p = count / n;
+        return p * std::log(p);
+    };
+
+    double randA = 0., randB = unlabeled / n, randAB = unlabeled / n;
+    double viA = 0., viB = -unlabeled / n * std::log(n), viAB = -unlabeled / n / std::log(n);
+    for(const auto & entry : overlaps) {
+        randAB += entry.second * entry.second;
+        viAB += plogp(entry.second);
+    }
+    for(const auto & entry : rowSums) {
+        randA += entry.second * entry.second;
+        viA += plogp(entry.second);
+    }
+    for(const auto & entry : colSums) {
+        randB += entry.second * entry.second;
+        viB += plogp(entry.second);
+    }
+
+    MetricValues values;
+    values[0] = 1. - (randA + randB - 2. * randAB) / (n * n);
+    values[1] = randAB / randB;
+    values[2] = randAB / randA;
+    values[3] = 2. * values[1] * values[2] / (values[1] + values[2]);
+    values[4] = viA + viB - 2. * viAB;
+    values[5] = viA == 0. ? 0. : (viB == 0. ? 1. : (viA + viB - viAB) / viA);
+    values[6] = viA == 0. ? 1. : (viB == 0. ? 0. : (viB + viA - viAB) / viB);
+    values[7] = 2. * values[5] * values[6] / (values[5] + values[6]);
+    return values;
+}
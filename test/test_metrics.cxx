@@ -0,0 +1,510 @@
+// correctness tests of the NeuroMetrics metrics:
+// small volumes against the brute force code, medium volumes against the deprecated
+// partition-comparison code, and all engines against the map based reference oracle
+
+#include <array>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+#include <map>
+#include <stdexcept>
+#include <thread>
+#include <chrono>
+#include <limits>
+
+#include <andres/marray.hxx>
+
+#include "NeuroMetrics/metrics.hxx"
+#include "NeuroMetrics/batched_metrics.hxx"
+#include "NeuroMetrics/weighted_metrics.hxx"
+#include "NeuroMetrics/brute_force.hxx"
+#include "NeuroMetrics/deprecated/partition-comparison.hxx"
+#include "NeuroMetrics/tools/for_each_coordinate.hxx"
+#include "generate_test_data.hxx"
+#include "reference_metrics.hxx"
+
+using namespace neurometrics;
+
+static size_t numberOfFailures = 0;
+
+void checkClose(const double value, const double expected, const std::string & what) {
+    if(!(std::abs(value - expected) <= 1e-9 * std::max(1., std::abs(expected)))) {
+        ++numberOfFailures;
+        std::cerr << "FAILED " << what << ": " << value << " != " << expected << std::endl;
+    }
+}
+
+void checkClose(const MetricValues & values, const MetricValues & expected, const std::string & what) {
+    const char * names[] = {"randIndex", "randPrecision", "randRecall", "randScore",
+        "variationOfInformation", "viPrecision", "viRecall", "viScore"};
+    for(size_t i = 0; i < values.size(); ++i)
+        checkClose(values[i], expected[i], what + " " + names[i]);
+}
+
+void checkThrown(const bool hasThrown, const std::string & what) {
+    if(!hasThrown) {
+        ++numberOfFailures;
+        std::cerr << "FAILED " << what << ": no exception" << std::endl;
+    }
+}
+
+template<unsigned DIM, class T>
+MetricValues metricValues(NeuroMetrics<DIM,T> & m) {
+    return MetricValues{{m.randIndex(), m.randPrecision(), m.randRecall(), m.randScore(),
+        m.variationOfInformation(), m.viPrecision(), m.viRecall(), m.viScore()}};
+}
+
+// labels 1 ... segRange, no element has label 0
+template<class T, unsigned DIM>
+andres::Marray<T> generateForeground(const std::array<size_t,DIM> & shape, const T segRange,
+        const size_t maxSegmentLen, const unsigned seed) {
+    auto seg = generateTestSegmentation<T,DIM>(shape, T(segRange - 1), maxSegmentLen, seed);
+    for(auto it = seg.begin(); it != seg.end(); ++it)
+        *it += 1;
+    return seg;
+}
+
+// copy of a (possibly strided) view in an owned array
+template<unsigned DIM, class T>
+andres::Marray<T> copyView(const andres::View<T> & view) {
+    typedef std::array<int64_t,DIM> Coord;
+    Coord shape;
+    for(size_t d = 0; d < DIM; ++d)
+        shape[d] = view.shape(d);
+    andres::Marray<T> ret(shape.begin(), shape.end());
+    tools::forEachCoordinate(shape, [&](const Coord & coord){
+        ret(coord.begin()) = view(coord.begin());
+    });
+    return ret;
+}
+
+
+// brute force rand index and partition-comparison vi, no label 0.
+// rand index: 1 - RI is normalized by n^2 here and by n(n-1) in the brute force code
+template<class T, unsigned DIM>
+void testAgainstBruteForce(const std::array<size_t,DIM> & shape, const std::string & name) {
+    auto segA = generateForeground<T,DIM>(shape, 20, 8, 1);
+    auto segB = generateForeground<T,DIM>(shape, 30, 5, 2);
+    const double n = segA.size();
+
+    NeuroMetrics<DIM,T> m;
+    m.computeContingecyTable(segA, segB);
+
+    const double riBruteForce = randIndexBruteForce(segA.begin(), segA.end(), segB.begin());
+    checkClose((1. - m.randIndex()) * n, (1. - riBruteForce) * (n - 1), name + " randIndex vs brute force");
+    checkClose(m.variationOfInformation(),
+        andres::variationOfInformation(segA.begin(), segA.end(), segB.begin()),
+        name + " variationOfInformation vs partition-comparison");
+    checkClose(metricValues(m), referenceMetrics(segA.begin(), segA.end(), segB.begin()),
+        name + " vs reference");
+
+    // without label 0 the per segment errors add up to the metrics
+    auto sum = [](const std::vector<double> & errors) {
+        return std::accumulate(errors.begin(), errors.end(), 0.);
+    };
+    checkClose(sum(m.viSplitErrors()) + sum(m.viMergeErrors()), m.variationOfInformation(),
+        name + " vi segment errors");
+    checkClose(sum(m.randSplitErrors()) + sum(m.randMergeErrors()), 1. - m.randIndex(),
+        name + " rand segment errors");
+
+    const std::vector<double> & errors = m.viMergeErrors();
+    std::vector<double> sortedErrors(errors);
+    std::sort(sortedErrors.rbegin(), sortedErrors.rend());
+    const std::vector<size_t> worst = largestErrors(errors, 5);
+    checkClose(worst.size(), std::min<size_t>(5, errors.size()), name + " number of largest errors");
+    for(size_t i = 0; i < worst.size(); ++i)
+        checkClose(errors[worst[i]], sortedErrors[i], name + " largest errors");
+
+    // a snapshot keeps its values when an edit recomputes the errors
+    const auto snapshot = m.viMergeErrorsSnapshot();
+    const std::vector<double> snapshotValues(*snapshot);
+    m.merge(T(1), T(2));
+    checkClose(m.viMergeErrors().size(), snapshotValues.size(), name + " errors after merge");
+    for(size_t i = 0; i < snapshotValues.size(); ++i)
+        checkClose((*snapshot)[i], snapshotValues[i], name + " error snapshot");
+}
+
+
+// partition-comparison rand index and vi on medium volumes, no label 0
+template<class T, unsigned DIM>
+void testAgainstPartitionComparison(const std::array<size_t,DIM> & shape, const std::string & name) {
+    auto segA = generateForeground<T,DIM>(shape, 500, 64, 3);
+    auto segB = generateForeground<T,DIM>(shape, 2000, 32, 4);
+    const double n = segA.size();
+
+    NeuroMetrics<DIM,T> m;
+    m.computeContingecyTable(segA, segB, 4);
+
+    checkClose((1. - m.randIndex()) * n,
+        (1. - andres::randIndex(segA.begin(), segA.end(), segB.begin())) * (n - 1),
+        name + " randIndex vs partition-comparison");
+    checkClose(m.variationOfInformation(),
+        andres::variationOfInformation(segA.begin(), segA.end(), segB.begin()),
+        name + " variationOfInformation vs partition-comparison");
+}
+
+
+// all engines against the reference oracle, with label 0 in both segmentations
+template<class T, unsigned DIM>
+void testEngines(const std::array<size_t,DIM> & shape, const std::string & name) {
+    typedef std::array<int64_t,DIM> Coord;
+
+    // the segmentations are views into larger arrays, so they are strided
+    std::array<size_t,DIM> paddedShape;
+    Coord offset, viewShape;
+    for(size_t d = 0; d < DIM; ++d) {
+        paddedShape[d] = shape[d] + 3;
+        offset[d] = 1;
+        viewShape[d] = shape[d];
+    }
+    auto paddedA = generateTestSegmentation<T,DIM>(paddedShape, T(300), 40, 5);
+    auto paddedB = generateTestSegmentation<T,DIM>(paddedShape, T(700), 20, 6);
+    const andres::View<T> stridedA = paddedA.view(offset.begin(), viewShape.begin());
+    const andres::View<T> stridedB = paddedB.view(offset.begin(), viewShape.begin());
+    auto segA = copyView<DIM>(stridedA);
+    auto segB = copyView<DIM>(stridedB);
+
+    const MetricValues expected = referenceMetrics(segA.begin(), segA.end(), segB.begin());
+
+    {
+        NeuroMetrics<DIM,T> m;
+        m.computeContingecyTable(segA, segB);
+        checkClose(metricValues(m), expected, name + " single thread");
+    }
+    for(const int numberOfThreads : {1, 2, 5}) {
+        NeuroMetrics<DIM,T> m;
+        m.computeContingecyTable(segA, segB, numberOfThreads);
+        checkClose(metricValues(m), expected, name + " threads " + std::to_string(numberOfThreads));
+        m.computeContingecyTable(stridedA, stridedB, numberOfThreads);
+        checkClose(metricValues(m), expected, name + " strided threads " + std::to_string(numberOfThreads));
+    }
+
+    // a smaller segB throws instead of being read out of bounds, single thread and threaded
+    {
+        Coord smallerShape = viewShape;
+        smallerShape[0] -= 1;
+        Coord zeroCoord;
+        zeroCoord.fill(0);
+        const andres::View<T> smallerB = segB.view(zeroCoord.begin(), smallerShape.begin());
+        for(const int numberOfThreads : {0, 2}) {
+            NeuroMetrics<DIM,T> m;
+            bool hasThrown = false;
+            try {
+                if(numberOfThreads == 0)
+                    m.computeContingecyTable(segA, smallerB);
+                else
+                    m.computeContingecyTable(segA, smallerB, numberOfThreads);
+            }
+            catch(const std::runtime_error &) {
+                hasThrown = true;
+            }
+            checkThrown(hasThrown, name + " different shapes "
+                + (numberOfThreads == 0 ? std::string("single thread") : "threads " + std::to_string(numberOfThreads)));
+        }
+    }
+
+    // streaming over slabs along the first axis
+    {
+        NeuroMetrics<DIM,T> m;
+        const int64_t slabSize = 7;
+        int64_t slabBegin = 0;
+        m.computeContingencyTableFromChunks([&](andres::Marray<T> & chunkA, andres::Marray<T> & chunkB){
+            if(slabBegin >= int64_t(shape[0]))
+                return false;
+            Coord begin, slabShape;
+            begin.fill(0);
+            begin[0] = slabBegin;
+            slabShape = viewShape;
+            slabShape[0] = std::min<int64_t>(slabSize, shape[0] - slabBegin);
+            chunkA = copyView<DIM>(segA.view(begin.begin(), slabShape.begin()));
+            chunkB = copyView<DIM>(segB.view(begin.begin(), slabShape.begin()));
+            slabBegin += slabSize;
+            return true;
+        }, 3);
+        checkClose(metricValues(m), expected, name + " chunks");
+    }
+
+    // explicit stream, accumulating after finalize needs a reset since the running table is released
+    {
+        NeuroMetrics<DIM,T> m;
+        m.resetContingencyTable();
+        m.accumulateContingencyTable(segA, segB, 2);
+        m.finalizeContingencyTable();
+        checkClose(metricValues(m), expected, name + " stream");
+        bool hasThrown = false;
+        try {
+            m.accumulateContingencyTable(segA, segB, 2);
+        }
+        catch(const std::runtime_error &) {
+            hasThrown = true;
+        }
+        checkThrown(hasThrown, name + " accumulate after finalize");
+        m.resetContingencyTable();
+        m.accumulateContingencyTable(segA, segB, 2);
+        m.finalizeContingencyTable();
+        checkClose(metricValues(m), expected, name + " stream after reset");
+    }
+
+    // chunks whose shapes do not match throw, the pending read of the next chunk has to finish first
+    {
+        NeuroMetrics<DIM,T> m;
+        size_t numberOfChunks = 0;
+        bool hasThrown = false;
+        try {
+            m.computeContingencyTableFromChunks([&](andres::Marray<T> & chunkA, andres::Marray<T> & chunkB){
+                if(numberOfChunks++ == 4)
+                    return false;
+                // slow reads, so the next chunk is still pending when counting the current one throws
+                if(numberOfChunks > 1)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                Coord shapeB = viewShape;
+                shapeB[0] -= 1;
+                chunkA.resize(viewShape.begin(), viewShape.end());
+                chunkB.resize(shapeB.begin(), shapeB.end());
+                return true;
+            }, 3);
+        }
+        catch(const std::runtime_error &) {
+            hasThrown = true;
+        }
+        checkThrown(hasThrown, name + " chunks with different shapes");
+    }
+
+    // batched, the same candidates contiguous and strided
+    {
+        auto otherB = generateTestSegmentation<T,DIM>(shape, T(50), 60, 7);
+        const MetricValues expectedOther = referenceMetrics(segA.begin(), segA.end(), otherB.begin());
+        const std::vector<andres::View<T> > contiguousCandidates = {segB, otherB};
+        const std::vector<andres::View<T> > stridedCandidates = {stridedB, otherB};
+        for(const auto * candidates : {&contiguousCandidates, &stridedCandidates}) {
+            const size_t resultShape[] = {2, size_t(NumberOfBatchedMetrics)};
+            andres::Marray<double> results(resultShape, resultShape + 2);
+            batchedMetrics<DIM>(candidates == &contiguousCandidates ? andres::View<T>(segA) : stridedA,
+                *candidates, results, 3);
+            for(size_t i = 0; i < 2; ++i) {
+                MetricValues values;
+                for(size_t j = 0; j < values.size(); ++j)
+                    values[j] = results(i, j);
+                checkClose(values, i == 0 ? expected : expectedOther, name + " batched " + std::to_string(i));
+            }
+        }
+    }
+
+    // weighted with non-integer weights
+    {
+        andres::Marray<double> weights(shape.begin(), shape.end());
+        std::vector<double> weightVec;
+        size_t i = 0;
+        for(auto it = weights.begin(); it != weights.end(); ++it, ++i) {
+            *it = 0.25 + (i % 5) * 0.5;
+            weightVec.push_back(*it);
+        }
+        NeuroMetrics<DIM,T> m;
+        computeWeightedContingencyTable<DIM>(m, segA, segB, weights, 3);
+        checkClose(metricValues(m), referenceMetrics(segA.begin(), segA.end(), segB.begin(), weightVec.data()),
+            name + " weighted");
+
+        // float weights, strided segmentations
+        andres::Marray<float> floatWeights(shape.begin(), shape.end());
+        std::copy(weights.begin(), weights.end(), floatWeights.begin());
+        computeWeightedContingencyTable<DIM>(m, stridedA, stridedB, floatWeights, 3);
+        checkClose(metricValues(m), referenceMetrics(segA.begin(), segA.end(), segB.begin(), weightVec.data()),
+            name + " weighted float");
+
+        // negative and non-finite weights throw, contiguous and strided
+        const size_t middle = weights.size() / 2;
+        for(const double badWeight : {-1., std::numeric_limits<double>::quiet_NaN(),
+                std::numeric_limits<double>::infinity()}) {
+            weights(middle) = badWeight;
+            for(const bool strided : {false, true}) {
+                bool hasThrown = false;
+                try {
+                    NeuroMetrics<DIM,T> mBad;
+                    computeWeightedContingencyTable<DIM>(mBad, strided ? stridedA : andres::View<T>(segA),
+                        strided ? stridedB : andres::View<T>(segB), weights, 3);
+                }
+                catch(const std::runtime_error &) {
+                    hasThrown = true;
+                }
+                checkThrown(hasThrown, name + " weight " + std::to_string(badWeight)
+                    + (strided ? " strided" : " contiguous"));
+            }
+        }
+        weights(middle) = weightVec[middle];
+    }
+
+    // incremental merge and split against a recount
+    {
+        NeuroMetrics<DIM,T> m;
+        m.computeContingecyTable(segA, segB);
+        metricValues(m);
+        auto editedB = segB;
+
+        m.merge(T(3), T(5));
+        for(auto it = editedB.begin(); it != editedB.end(); ++it)
+            if(*it == T(5))
+                *it = T(3);
+        checkClose(metricValues(m), referenceMetrics(segA.begin(), segA.end(), editedB.begin()),
+            name + " merge");
+
+        // move every second element of segment 3 to the new segment 1000
+        std::vector<T> movedLabels;
+        size_t count = 0;
+        auto itA = segA.begin();
+        for(auto it = editedB.begin(); it != editedB.end(); ++it, ++itA) {
+            if(*it == T(3) && count++ % 2 == 0) {
+                *it = T(1000);
+                movedLabels.push_back(*itA);
+            }
+        }
+        m.split(T(3), T(1000), movedLabels.begin(), movedLabels.end());
+        checkClose(metricValues(m), referenceMetrics(segA.begin(), segA.end(), editedB.begin()),
+            name + " split");
+
+        // merge into a label that is not in the table yet
+        m.merge(T(2000), T(7));
+        for(auto it = editedB.begin(); it != editedB.end(); ++it)
+            if(*it == T(7))
+                *it = T(2000);
+        checkClose(metricValues(m), referenceMetrics(segA.begin(), segA.end(), editedB.begin()),
+            name + " merge into new label");
+
+        // split given as (labelA, count) pairs: move the elements of segment 2000 with even labels of A,
+        // including label 0, to the new segment 1500
+        std::map<T,double> overlapMap;
+        itA = segA.begin();
+        for(auto it = editedB.begin(); it != editedB.end(); ++it, ++itA) {
+            if(*it == T(2000) && *itA % 2 == 0) {
+                *it = T(1500);
+                overlapMap[*itA] += 1.;
+            }
+        }
+        const std::vector<std::pair<T,double> > overlap(overlapMap.begin(), overlapMap.end());
+        m.split(T(2000), T(1500), overlap);
+        const MetricValues expectedEdited = referenceMetrics(segA.begin(), segA.end(), editedB.begin());
+        checkClose(metricValues(m), expectedEdited, name + " split with overlap");
+
+        // the throwing edits leave the table unchanged
+        auto checkThrowsUnchanged = [&](const T labelB, const T newLabelB,
+                const std::vector<std::pair<T,double> > & badOverlap, const std::string & what) {
+            bool hasThrown = false;
+            try {
+                m.split(labelB, newLabelB, badOverlap);
+            }
+            catch(const std::runtime_error &) {
+                hasThrown = true;
+            }
+            checkThrown(hasThrown, name + " " + what);
+            checkClose(metricValues(m), expectedEdited, name + " unchanged after " + what);
+        };
+        const T rowLabel = overlap.back().first;
+        checkThrowsUnchanged(T(1500), T(1600), {{rowLabel, -2.}}, "negative count");
+        checkThrowsUnchanged(T(1500), T(1600), {{rowLabel, overlapMap[rowLabel] + 1.}}, "count too large");
+        checkThrowsUnchanged(T(1500), T(1600), {{T(0), 1e9}}, "background count too large");
+        checkThrowsUnchanged(T(1500), T(2000), {{rowLabel, 1.}}, "new label in use");
+        checkThrowsUnchanged(T(1500), T(1), {{rowLabel, 1.}}, "new label in use 1");
+        checkThrowsUnchanged(T(5), T(1600), {{rowLabel, 1.}}, "split of a merged away segment");
+        checkThrowsUnchanged(T(1500), T(0), {{rowLabel, 1.}}, "split to label 0");
+
+        // a segment that only overlaps label 0 of A is known to the edits:
+        // move the background elements of a segment to the new segment 1700
+        T backgroundLabel = 0;
+        double backgroundCount = 0.;
+        itA = segA.begin();
+        for(auto it = editedB.begin(); it != editedB.end(); ++it, ++itA) {
+            if(*itA == 0 && *it != 0 && (backgroundLabel == 0 || *it == backgroundLabel)) {
+                backgroundLabel = *it;
+                backgroundCount += 1.;
+            }
+        }
+        m.split(backgroundLabel, T(1700), {{T(0), backgroundCount}});
+        itA = segA.begin();
+        for(auto it = editedB.begin(); it != editedB.end(); ++it, ++itA)
+            if(*it == backgroundLabel && *itA == 0)
+                *it = T(1700);
+        checkClose(metricValues(m), referenceMetrics(segA.begin(), segA.end(), editedB.begin()),
+            name + " split of background elements");
+        {
+            bool hasThrown = false;
+            try {
+                m.split(T(1500), T(1700), {{rowLabel, 1.}});
+            }
+            catch(const std::runtime_error &) {
+                hasThrown = true;
+            }
+            checkThrown(hasThrown, name + " new label only outside the table");
+        }
+        m.merge(T(1500), T(1700));
+        for(auto it = editedB.begin(); it != editedB.end(); ++it)
+            if(*it == T(1700))
+                *it = T(1500);
+        checkClose(metricValues(m), referenceMetrics(segA.begin(), segA.end(), editedB.begin()),
+            name + " merge of a background segment");
+
+        // a label without elements: merging it does nothing, only the empty split is valid
+        const MetricValues beforeNoOp = metricValues(m);
+        m.merge(T(1500), T(5000));
+        m.split(T(5000), T(5001), std::vector<std::pair<T,double> >());
+        checkClose(metricValues(m), beforeNoOp, name + " edits of a label without elements");
+        bool hasThrown = false;
+        try {
+            m.split(T(5000), T(5001), {{rowLabel, 1.}});
+        }
+        catch(const std::runtime_error &) {
+            hasThrown = true;
+        }
+        checkThrown(hasThrown, name + " split of a label without elements");
+    }
+}
+
+
+// merging all segments of B into one, the end of an agglomeration, against a recount.
+// the vi measures branch on exact zeros of the primitives, which the edits have to reproduce
+template<class T, unsigned DIM>
+void testMergeAll(const std::array<size_t,DIM> & shape, const T segRangeA, const T segRangeB,
+        const std::string & name) {
+    auto segA = generateForeground<T,DIM>(shape, segRangeA, 8, 7);
+    auto segB = generateForeground<T,DIM>(shape, segRangeB, 4, 8);
+
+    NeuroMetrics<DIM,T> m;
+    m.computeContingecyTable(segA, segB);
+    metricValues(m);
+    for(T labelB = 2; labelB <= segRangeB; ++labelB)
+        m.merge(T(1), labelB);
+
+    auto mergedB = segB;
+    for(auto it = mergedB.begin(); it != mergedB.end(); ++it)
+        *it = T(1);
+    NeuroMetrics<DIM,T> recount;
+    recount.computeContingecyTable(segA, mergedB);
+    checkClose(metricValues(m), metricValues(recount), name + " merge all vs recount");
+}
+
+
+int main() {
+
+    testAgainstBruteForce<uint32_t,1>({{600}}, "1d uint32");
+    testAgainstBruteForce<uint64_t,2>({{24, 25}}, "2d uint64");
+    testAgainstBruteForce<uint32_t,3>({{8, 9, 7}}, "3d uint32");
+
+    testAgainstPartitionComparison<uint32_t,3>({{64, 64, 64}}, "3d uint32");
+    testAgainstPartitionComparison<uint64_t,2>({{300, 400}}, "2d uint64");
+
+    testEngines<uint32_t,1>({{100000}}, "1d uint32");
+    testEngines<uint64_t,2>({{300, 257}}, "2d uint64");
+    testEngines<uint32_t,3>({{45, 70, 33}}, "3d uint32");
+    testEngines<uint64_t,3>({{64, 64, 64}}, "3d uint64");
+
+    testMergeAll<uint64_t,3>({{64, 64, 64}}, 50, 200, "3d uint64");
+    testMergeAll<uint32_t,2>({{2, 1}}, 2, 2, "2d uint32");
+
+    if(numberOfFailures > 0) {
+        std::cerr << numberOfFailures << " checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "all checks passed" << std::endl;
+    return 0;
+}